@@ -1,5 +1,5 @@
 #define DISPLAY_ORIENTATION 3 //Rotation of the display in 90° steps form 0 to 3
-#define NUM_BADGES 3 // Not tested to be memory safe with more than 20 devices
+#define NUM_BADGES 3 // Bounds the pictures a badge can collect, the roster itself may list any number of badges
 #define NUM_PICS 3 // This should be low (< 5) for larger numbers of badges
 #define MAX_GROUP_SIZE 4
 
@@ -17,12 +17,59 @@
 #define VISUALISATION_UPDATE_INTERVAL 5    // default scheduling time for currentPatternSELECT, in milliseconds
 #define LOGO_DELAY 3000
 #define BATTERY_CHARGE_CHECK_INTERVAL 5000
+#define SERIAL_COMMAND_INTERVAL 100
 #define ENERGY_SAFE_TIMEOUT 3600
 #define FS_NO_GLOBALS
 #define CALIBRATION_TIME 700
 #define CALIBRATION_SAMPLES 5
 #define SENSITIVITY_RANGE 12
 #define BADGES_FILE "/badges.json"
-#define CONFIG_FILE "/config.json"
-#define LOG_FILE "/interactionslog.json"
-#define LOGGING_LIMIT 2000000
\ No newline at end of file
+#define CONFIG_FILE "/config.json" // only imported if there is no valid snapshot
+#define CONFIG_SLOT_FILE "/config%u.bin" // snapshots alternate between two slots, see FileStorage::saveConfiguration
+#define LOG_SEGMENT_FILE "/log%05u.bin"
+#define PICTURE_CACHE_FILE "/%s.565" // decoded RGB565 pixels of the picture with the same name, see ScreenController.cpp
+#define PICTURE_CACHE_INTERVAL 2000 // ms between two pictures decoded into the cache, skipped while bonding
+#define SCREEN_DMA 1 // overlap decoding and the SPI transfer of the pixels, 0 to push them synchronously
+#ifndef RENDER_TIMING
+#define RENDER_TIMING 0 // 1 to print how long the homescreen takes to render, the tdisplay-debug environment does
+#endif
+#define LOG_MANIFEST_FILE "/logmanifest.bin"
+#define UPLOAD_STATE_FILE "/upload.bin" // first segment not yet uploaded to a collector
+#define FLASH_STATS_FILE "/flashstats.bin" // write and wear statistics, see FlashStats.h
+#define FLASH_STATS_SAVE_INTERVAL 600000 // ms between two saves of the statistics, also saved on every flush that wrote something
+#define LOG_INDEX_FILE "/log%05u.idx" // sparse index of the segment with the same number
+#define LOG_SEGMENT_SIZE 65536 // segments are sealed once they reach this size
+#define LOG_MAX_SEGMENTS 0 // number of segments to retain, 0 to keep as many as LOGGING_LIMIT allows
+#define LOG_RECYCLE_SEGMENTS 1 // delete the oldest segments when the limit is reached, 0 to halt logging instead
+#define LOG_KEYFRAME_INTERVAL 32 // connection changes logged as joins and leaves between two full snapshots
+#define LOGGING_LIMIT 2000000
+#define LOG_CONNECTIONS 1 // log every connection change, 0 to log only the encounter summaries
+#ifndef LOG_FILE_LEVEL
+#define LOG_FILE_LEVEL LOG_LEVEL_ALL // events written to flash, see logLevel_t in LogSink.h
+#endif
+#ifndef LOG_SERIAL_LEVEL
+#define LOG_SERIAL_LEVEL LOG_LEVEL_OFF // events mirrored to the Serial, the tdisplay-debug environment mirrors all
+#endif
+#define LOG_RING_LEVEL LOG_LEVEL_ALL // events kept in RAM for the RECENT command
+#define LOG_RING_RECORDS 64
+#define LOG_UPLINK_LEVEL LOG_LEVEL_OFF // events broadcast over the mesh
+#define LOG_UPLINK_RECORDS 64 // records waiting for the uplink, a power of two fitting the largest connection event
+#define LOG_UPLINK_PACKAGE_RECORDS 8 // records sent per package
+#define LOG_UPLINK_INTERVAL 500 // ms between two uplink packages
+#define ENCOUNTER_MERGE_GAP 60 // s a peer may be gone and still continue its previous encounter
+#define ENCOUNTER_CHECKPOINT_INTERVAL 300000 // ms between two encounter summaries
+#define LOG_EXPORT_BAUD 921600 // baud rate while exporting the log in frames
+#define LOG_EXPORT_BLOCK 4096 // bytes read from flash and sent per frame
+#ifndef LOG_COLLECTOR
+#define LOG_COLLECTOR 0 // 1 to collect the logs of the other badges instead of uploading, see the collector environment
+#endif
+#define UPLOAD_CHUNK_SIZE 512 // bytes of a sealed segment per chunk
+#define UPLOAD_CHUNK_INTERVAL 200 // ms between two chunks of a badge, limits the airtime used by the upload
+#define UPLOAD_ACK_TIMEOUT 2000 // ms to wait for an acknowledgement before sending the chunk again, doubled with every retry
+#define UPLOAD_MAX_BACKOFF 60000 // ms between retries at most
+#define UPLOAD_BONDING_BACKOFF 10000 // ms the upload stays paused after bonding
+#define UPLOAD_DELETE_SEGMENTS 0 // 1 to delete segments once they are uploaded
+#define UPLOAD_BEACON_INTERVAL 5000 // ms between two beacons of the collector
+#define UPLOAD_COLLECTOR_TIMEOUT 30000 // ms without a beacon after which the collector is considered gone
+#define UPLOAD_MAX_BADGES 64 // uploads the collector tracks at once
+#define UPLOAD_COLLECTOR_BAUD LOG_EXPORT_BAUD // baud rate of the frames the collector forwards to the host
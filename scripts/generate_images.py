@@ -0,0 +1,119 @@
+# Compresses the RGB565 pictures in include/ressources into constant arrays,
+# so the badge draws them from flash instead of decoding their JPEG from the
+# filesystem (see BuiltinImages.h for the format).
+#
+# Runs as PlatformIO pre-build script and writes BuiltinImagesData.h into the
+# build directory. The pictures are listed by custom_builtin_images in
+# platformio.ini. It can also be called directly:
+#   python3 scripts/generate_images.py include/ressources BuiltinImagesData.h aalto bmo nude
+
+import os
+import re
+import sys
+
+MAX_RUN = 128
+# Pictures that do not shrink to this share of their raw size, e.g. photos,
+# are left to the JPEG and the picture cache
+MAX_RATIO = 0.5
+
+
+def read_header(path):
+    """Pixels and size of an array written by ImageConverter 565."""
+    with open(path) as f:
+        text = f.read()
+    size = re.search(r"Image Size\s*:\s*(\d+)x(\d+)", text)
+    if not size:
+        raise ValueError("%s: no image size" % path)
+    width, height = int(size.group(1)), int(size.group(2))
+    body = re.sub(r"//[^\n]*", "", text[text.index("{") + 1:text.rindex("}")])
+    pixels = [int(value, 16) for value in re.findall(r"0x[0-9A-Fa-f]+", body)]
+    if len(pixels) != width * height:
+        raise ValueError("%s: %d pixels instead of %dx%d" % (path, len(pixels), width, height))
+    return width, height, pixels
+
+
+def pixel_bytes(pixel):
+    return [pixel & 0xFF, pixel >> 8]
+
+
+def encode_row(row):
+    """Runs of equal pixels, and the pixels between them as literals."""
+    out = []
+    i = 0
+    while i < len(row):
+        run = 1
+        while i + run < len(row) and run < MAX_RUN and row[i + run] == row[i]:
+            run += 1
+        if run > 1:
+            out.append(0x80 | (run - 1))
+            out += pixel_bytes(row[i])
+            i += run
+            continue
+        literal = 1
+        while (i + literal < len(row) and literal < MAX_RUN and
+               not (i + literal + 1 < len(row) and row[i + literal + 1] == row[i + literal])):
+            literal += 1
+        out.append(literal - 1)
+        for pixel in row[i:i + literal]:
+            out += pixel_bytes(pixel)
+        i += literal
+    return out
+
+
+def encode(width, height, pixels):
+    data = []
+    for y in range(height):
+        data += encode_row(pixels[y * width:(y + 1) * width])
+    return data
+
+
+def generate(directory, names):
+    lines = [
+        "// Generated by scripts/generate_images.py from include/ressources. Do not edit.",
+        "#pragma once",
+        "",
+    ]
+    images = []
+    for name in names:
+        width, height, pixels = read_header(os.path.join(directory, name + ".h"))
+        data = encode(width, height, pixels)
+        raw = width * height * 2
+        if len(data) > raw * MAX_RATIO:
+            print("Built-in image %s skipped, compresses to %d of %d bytes" % (name, len(data), raw))
+            continue
+        print("Built-in image %s: %d of %d bytes" % (name, len(data), raw))
+        lines.append("static const uint8_t BUILTIN_IMAGE_%s[] = {" % name.upper())
+        for i in range(0, len(data), 24):
+            lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 24]) + ",")
+        lines += ["};", ""]
+        images.append((name, width, height, len(data)))
+
+    lines.append("#define BUILTIN_IMAGE_COUNT %d" % len(images))
+    lines.append("static const builtinImage_t BUILTIN_IMAGES[] = {")
+    for name, width, height, size in images:
+        lines.append('    {"%s", %d, %d, BUILTIN_IMAGE_%s, %du},' % (name, width, height, name.upper(), size))
+    if not images:
+        lines.append("    {\"\", 0, 0, nullptr, 0},")
+    lines += ["};", ""]
+    return "\n".join(lines)
+
+
+def write_if_changed(path, content):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == content:
+                return
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(content)
+
+
+if __name__ == "__main__":
+    write_if_changed(sys.argv[2], generate(sys.argv[1], sys.argv[3:]))
+else:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    generated = os.path.join(env.subst("$BUILD_DIR"), "generated")  # noqa: F821
+    names = env.GetProjectOption("custom_builtin_images", "").split()  # noqa: F821
+    write_if_changed(os.path.join(generated, "BuiltinImagesData.h"),
+                     generate(os.path.join(env.subst("$PROJECT_INCLUDE_DIR"), "ressources"), names))  # noqa: F821
+    env.Append(CPPPATH=[generated])  # noqa: F821
@@ -0,0 +1,132 @@
+# Compiles data/badges.json into a constant table, so a badge resolves its
+# configuration without parsing JSON or touching the filesystem.
+#
+# Runs as PlatformIO pre-build script and writes BadgeRosterData.h into the
+# build directory. It can also be called directly:
+#   python3 scripts/generate_roster.py data/badges.json BadgeRosterData.h
+
+import json
+import os
+import random
+import sys
+
+
+def mix(x):
+    """32 bit finalizer of MurmurHash3, same as rosterMix() in BadgeRoster.h."""
+    x ^= x >> 16
+    x = (x * 0x85EBCA6B) & 0xFFFFFFFF
+    x ^= x >> 13
+    x = (x * 0xC2B2AE35) & 0xFFFFFFFF
+    x ^= x >> 16
+    return x
+
+
+def find_perfect_hash(ids):
+    """Hash and displace: ids are distributed into buckets, then every bucket
+    gets the smallest seed that moves all its ids to free slots."""
+    bucket_bits = max(0, (max(1, len(ids) // 4) - 1).bit_length())
+    slot_bits = max(1, (2 * len(ids) - 1).bit_length())
+    buckets = [[] for _ in range(1 << bucket_bits)]
+    for node in ids:
+        buckets[mix(node) >> (32 - bucket_bits) if bucket_bits else 0].append(node)
+
+    slots = [None] * (1 << slot_bits)
+    seeds = [0] * len(buckets)
+    mask = (1 << slot_bits) - 1
+    for index in sorted(range(len(buckets)), key=lambda b: -len(buckets[b])):
+        bucket = buckets[index]
+        if not bucket:
+            continue
+        seed = 0
+        while True:
+            taken = [mix(node ^ seed) & mask for node in bucket]
+            if len(set(taken)) == len(taken) and all(slots[t] is None for t in taken):
+                break
+            seed += 1
+        for node, slot in zip(bucket, taken):
+            slots[slot] = node
+        seeds[index] = seed
+    return bucket_bits, slot_bits, seeds, slots
+
+
+def generate(badges):
+    ids = [int(badge["id"]) for badge in badges]
+    if len(set(ids)) != len(ids):
+        raise ValueError("badges.json contains duplicate ids")
+    num_pics = {len(badge["pics"]) for badge in badges}
+    if len(num_pics) > 1:
+        raise ValueError("all badges need the same number of pictures")
+
+    bucket_bits, slot_bits, seeds, slot_nodes = find_perfect_hash(ids)
+    index_of = {node: index for index, node in enumerate(ids)}
+    slots = [index_of[node] + 1 if node is not None else 0 for node in slot_nodes]
+
+    # Members of each group, stored consecutively
+    groups = {}
+    for badge in badges:
+        groups.setdefault(int(badge["group"]), []).append(int(badge["id"]))
+    members = []
+    group_start = {}
+    for group in sorted(groups):
+        group_start[group] = len(members)
+        members.extend(groups[group])
+
+    lines = [
+        "// Generated by scripts/generate_roster.py from data/badges.json. Do not edit.",
+        "#pragma once",
+        "",
+        "#define BADGE_ROSTER_SIZE %d" % len(badges),
+        "#define BADGE_ROSTER_PICS %d" % (num_pics.pop() if num_pics else 0),
+        "#define BADGE_ROSTER_BUCKET_BITS %d" % bucket_bits,
+        "#define BADGE_ROSTER_SLOT_BITS %d" % slot_bits,
+        "",
+        "static constexpr rosterEntry_t BADGE_ROSTER[] = {",
+    ]
+    for badge in badges:
+        group = int(badge["group"])
+        lines.append("    {%du, 0x%06xu, {%s}, %d, %d}," % (
+            int(badge["id"]), int(badge["color"], 16),
+            ", ".join(str(int(p)) for p in badge["pics"]),
+            group_start[group], len(groups[group])))
+    # Arrays may not be empty, so an empty roster gets a placeholder that no
+    # slot points to
+    if not badges:
+        lines.append("    {0u, 0x000000u, {}, 0, 0},")
+    lines += [
+        "};",
+        "",
+        "// Seed of each bucket of the perfect hash",
+        "static constexpr uint32_t BADGE_ROSTER_SEEDS[] = {%s};" % ", ".join("%du" % s for s in seeds),
+        "",
+        "// Index + 1 into BADGE_ROSTER by perfect hash of the node id, 0 for empty slots",
+        "static constexpr uint16_t BADGE_ROSTER_SLOTS[] = {%s};" % ", ".join(str(s) for s in slots),
+        "",
+        "static constexpr uint32_t BADGE_ROSTER_MEMBERS[] = {%s};" % ", ".join("%du" % m for m in members or [0]),
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def write_if_changed(path, content):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == content:
+                return
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(content)
+
+
+def run(source, target):
+    with open(source) as f:
+        write_if_changed(target, generate(json.load(f)))
+
+
+if __name__ == "__main__":
+    run(sys.argv[1], sys.argv[2])
+else:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    generated = os.path.join(env.subst("$BUILD_DIR"), "generated")  # noqa: F821
+    run(os.path.join(env.subst("$PROJECT_DATA_DIR"), "badges.json"),  # noqa: F821
+        os.path.join(generated, "BadgeRosterData.h"))
+    env.Append(CPPPATH=[generated])  # noqa: F821
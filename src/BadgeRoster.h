@@ -0,0 +1,64 @@
+#pragma once
+
+// Badge roster compiled from data/badges.json by scripts/generate_roster.py.
+// Resolves the configuration of a badge with a perfect hash of its node id,
+// without parsing JSON or accessing the filesystem.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct rosterEntry_t
+{
+    uint32_t node;
+    uint32_t color;
+    uint8_t pics[NUM_PICS];
+    uint16_t groupStart; // first member of the group in BADGE_ROSTER_MEMBERS
+    uint16_t groupSize;  // members of the group including this badge
+};
+
+// 32 bit finalizer of MurmurHash3, must match mix() of the generator
+inline uint32_t rosterMix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+#if __has_include("BadgeRosterData.h")
+#include "BadgeRosterData.h"
+#define HAS_BADGE_ROSTER 1
+
+static_assert(BADGE_ROSTER_SIZE == 0 || BADGE_ROSTER_PICS == NUM_PICS, "badges.json has to list NUM_PICS pictures per badge");
+
+inline const rosterEntry_t *findRosterEntry(uint32_t node)
+{
+    const uint32_t bucket = (uint64_t)rosterMix(node) >> (32 - BADGE_ROSTER_BUCKET_BITS);
+    const uint32_t slot = rosterMix(node ^ BADGE_ROSTER_SEEDS[bucket]) & ((1u << BADGE_ROSTER_SLOT_BITS) - 1);
+    const uint16_t index = BADGE_ROSTER_SLOTS[slot];
+    if (index == 0 || BADGE_ROSTER[index - 1].node != node)
+    {
+        return nullptr;
+    }
+    return &BADGE_ROSTER[index - 1];
+}
+
+inline const uint32_t *rosterGroupMembers(const rosterEntry_t &entry)
+{
+    return &BADGE_ROSTER_MEMBERS[entry.groupStart];
+}
+#else
+#define HAS_BADGE_ROSTER 0
+
+inline const rosterEntry_t *findRosterEntry(uint32_t)
+{
+    return nullptr;
+}
+
+inline const uint32_t *rosterGroupMembers(const rosterEntry_t &)
+{
+    return nullptr;
+}
+#endif
@@ -13,11 +13,23 @@
 #include "time.h"
 #include <sys/time.h>
 #include "esp_adc_cal.h"
+#include "esp_timer.h"
+#include "MeshClock.h"
+#include "LogPackages.hpp"
+#include "LogUploader.h"
+#include "base64.h"
+#include "mbedtls/base64.h"
 
 // Prototypes
 void routineCheck();
 void setTempo();
 void checkDeviceStatus();
+void checkpointEncounters();
+void sendLogUplink();
+void uploadLog();
+void cachePictures();
+void sendCollectorBeacon();
+void sendLogChunk(uint32_t collector, uint32_t segment, uint32_t offset, uint32_t size, const uint8_t *data, size_t length);
 void buttonHandler(TouchButtons::InputType keyCode);
 void onPressed();
 void userStartBonding();
@@ -33,8 +45,21 @@ bool receivedExchangeCallback(protocol::Variant variant);
 bool receivedAbortCallback(protocol::Variant variant);
 bool receivedBeatCallback(protocol::Variant variant);
 bool receivedTimeCallback(protocol::Variant variant);
+bool receivedBeaconCallback(protocol::Variant variant);
+bool receivedAckCallback(protocol::Variant variant);
+bool receivedChunkCallback(protocol::Variant variant);
 
 FileStorage fileStorage{};
+// Sinks besides the log file, see checkSerialCommands() to change their levels
+LogSerialSink serialSink(LOG_SERIAL_LEVEL);
+LogRingSink<LOG_RING_RECORDS> ringSink(LOG_RING_LEVEL);
+LogQueueSink<LOG_UPLINK_RECORDS> uplinkSink(LOG_UPLINK_LEVEL);
+uint32_t uplinkSeq = 0;
+#if LOG_COLLECTOR
+LogCollector collector(Serial);
+#else
+LogUploader uploader(fileStorage, sendLogChunk);
+#endif
 RTC_DATA_ATTR badgeConfig_t configuration = {NUM_PICS, {}, 0xffffff, {0, 1, 2}}; // keep configuration in deep sleep
 
 EasyButton hwbutton1(HW_BUTTON_PIN1);
@@ -50,8 +75,14 @@ int32_t energyCountdown = ENERGY_SAFE_TIMEOUT;
 bool calc_delay = false;
 SimpleList<uint32_t> nodes;
 SimpleList<uint32_t> groupNodes;
+NodeSet connectedNodes;
+EncounterTable encounters(ENCOUNTER_MERGE_GAP * 1000000ULL);
+
+// Node time of the mesh extended to 64 bits, shared by logging and bonding
+MeshClock meshClock([]() { return (uint64_t)esp_timer_get_time(); }, []() { return mesh.getNodeTime(); });
 
 // @Override This function is called by FastLED inside lib8tion.h.Requests it to use mesg.getNodeTime instead of internal millis() timer.
+// The synced 32 bit node time is the same on all nodes, so the animations are too
 uint32_t get_millisecond_timer_hook()
 {
   return mesh.getNodeTime() / 1000;
@@ -67,6 +98,15 @@ Task taskShowLogo(LOGO_DELAY, TASK_ONCE, &showHomescreen);
 Task taskBondingPing(BONDINGPING, TASK_FOREVER, &sendBondingPing);
 Task taskSendBPM(TAPTIME,TASK_ONCE);
 Task taskReconnectMesh(TAPTIME, TASK_ONCE);
+Task taskSerialCommands(SERIAL_COMMAND_INTERVAL, TASK_FOREVER, &checkSerialCommands);
+Task taskCheckpointEncounters(ENCOUNTER_CHECKPOINT_INTERVAL, TASK_FOREVER, &checkpointEncounters);
+Task taskLogUplink(LOG_UPLINK_INTERVAL, TASK_FOREVER, &sendLogUplink);
+Task taskCachePictures(PICTURE_CACHE_INTERVAL, TASK_FOREVER, &cachePictures);
+#if LOG_COLLECTOR
+Task taskCollectorBeacon(UPLOAD_BEACON_INTERVAL, TASK_FOREVER, &sendCollectorBeacon);
+#else
+Task taskLogUpload(UPLOAD_CHUNK_INTERVAL, TASK_FOREVER, &uploadLog);
+#endif
 
 enum appState_t
 {
@@ -85,12 +125,12 @@ enum exchangeState_t
   BONDING_COMPLETE
 };
 exchangeState_t bondingState = BONDING_REQUESTED;
-uint32_t bondingStarttime = 0;
+uint64_t bondingStarttime = 0;
 int8_t candidateCompleted = -1;
 
 struct bondingRequest_t {
   uint32_t node;
-  uint32_t startt;
+  uint64_t startt;
 };
 
 SimpleList<bondingRequest_t> bondingCandidates;
@@ -112,13 +152,17 @@ void setup()
   displayMessage(F("Starting Up..."));
 
   //check filesystem
-  if (!SPIFFS.begin())
+  if (!fileStorage.begin())
   {
-    Serial.println("SPIFFS initialisation failed!");
+    Serial.println(STORAGE_NAME " initialisation failed!");
     while (1)
       yield(); // Stay here twiddling thumbs waiting
   }
-  Serial.print("SPIFFS initialised.\r\n");
+  Serial.print(STORAGE_NAME " initialised.\r\n");
+  serialSink.begin(Serial);
+  fileStorage.addSink(serialSink);
+  fileStorage.addSink(ringSink);
+  fileStorage.addSink(uplinkSink);
 
   // Start up mesh connection
   mesh.setDebugMsgTypes(ERROR | DEBUG); // set before init() so that you can see error messages
@@ -136,7 +180,7 @@ void setup()
       // load configuration from persistent storage
       fileStorage.initConfiguration(configuration, mesh.getNodeId());
     }
-    // fileStorage.printFile(CONFIG_FILE);
+    // fileStorage.exportConfiguration(Serial, configuration);
     freshStart = false;
   }
   Serial.printf("Booting with the following configurations: \r\n - colour: %#08x\r\n - pictures: %u\r\n", configuration.color, configuration.numPics);
@@ -158,6 +202,15 @@ void setup()
   mesh.onPackage(ABORT_PKG, &receivedAbortCallback);
   mesh.onPackage(BEAT_PKG, &receivedBeatCallback);
   mesh.onPackage(DATE_PKG, &receivedTimeCallback);
+#if LOG_COLLECTOR
+  // Forward the uploaded logs to the host in frames, see tools/logreceiver
+  mesh.setRoot(true);
+  mesh.onPackage(LOG_CHUNK_PKG, &receivedChunkCallback);
+  Serial.updateBaudRate(UPLOAD_COLLECTOR_BAUD);
+#else
+  mesh.onPackage(LOG_BEACON_PKG, &receivedBeaconCallback);
+  mesh.onPackage(LOG_ACK_PKG, &receivedAckCallback);
+#endif
 
   // Setup user input sensing (Do we need to wait here until people do not touch anymore???)
   touchInput.calibrate();
@@ -178,14 +231,29 @@ void setup()
   userScheduler.addTask(taskSendBPM);
   userScheduler.addTask(taskReconnectMesh);
   userScheduler.addTask(taskBondingPing);
+  userScheduler.addTask(taskSerialCommands);
+  taskSerialCommands.enable();
+  userScheduler.addTask(taskCheckpointEncounters);
+  taskCheckpointEncounters.enableDelayed(ENCOUNTER_CHECKPOINT_INTERVAL);
+  userScheduler.addTask(taskLogUplink);
+  taskLogUplink.enable();
+#if LOG_COLLECTOR
+  userScheduler.addTask(taskCollectorBeacon);
+  taskCollectorBeacon.enable();
+#else
+  userScheduler.addTask(taskLogUpload);
+  taskLogUpload.enable();
+#endif
 
   visualiser.setDefaultColor(configuration.color);
   userScheduler.addTask(taskVisualiser);
   visualiser.turnOff();
   userScheduler.addTask(taskShowLogo);
+  userScheduler.addTask(taskCachePictures);
+  taskCachePictures.enableDelayed(PICTURE_CACHE_INTERVAL);
   displayMessage(F("Filled the survey?"));
 
-  fileStorage.logBootEvent(mesh.getNodeTime());
+  fileStorage.log(BadgeEvent::power(meshClock.now()));
 
   randomSeed(analogRead(A0));
 }
@@ -254,9 +322,7 @@ void checkBatteryCharge(bool boot)
   float voltage = getInputVoltage();
   if (voltage < 3.0)
   {
-    tft.fillScreen(TFT_BLACK);
-    tft.setTextDatum(MC_DATUM);
-    tft.drawString("Got no juice :(", tft.width() / 2, tft.height() / 2);
+    displayMessage("Got no juice :("); // drawn while goToSleep() waits
     goToSleep(true);
   }
   else if ((!charging && voltage >= 4.5) || (charging && voltage < 4.5))
@@ -346,6 +412,8 @@ void goToSleep(bool touch)
   visualiser.turnOff();
   mesh.stop();
   Serial.println("Disconnected from mesh!");
+  checkpointEncounters();
+  fileStorage.flush(); // RAM is lost in deep sleep
   if (touch)
   {
     touchAttachInterrupt(TOUCHPIN_LEFT, wakeup_callback, STHRESHOLD);
@@ -407,17 +475,16 @@ void checkDeviceStatus()
               String(touchInput._buttonLeft.wasReleased());
   Serial.println("Button states: " + bs);
 
-  // Open file for reading
-  fs::File file = SPIFFS.open(LOG_FILE);
-  if (!file)
-  {
-    Serial.println(F("Failed to read file"));
-    return;
-  }
-  Serial.print("File size: " + String(file.size()) + "\r\n");
-  file.close();
-
-  Serial.print("Storage used: " + String(SPIFFS.usedBytes()) + "/" + String(SPIFFS.totalBytes()) + "\r\n");
+  Serial.print("File size: " + String(fileStorage.logSize()) + "\r\n");
+  Serial.print("Storage used: " + String(fileStorage.usedBytes()) + "/" + String(fileStorage.totalBytes()) + "\r\n");
+  Serial.print("Dropped log records: " + String(fileStorage.droppedRecords()) + "\r\n");
+  Serial.print("Dropped by the mirror: " + String(serialSink.dropped()) + ", the uplink: " + String(uplinkSink.dropped()) + "\r\n");
+  fileStorage.flashStats().print(Serial, fileStorage.totalBytes());
+  Serial.printf("Screens: %u requested, %u drawn\r\n", screenFramesRequested(), screenFramesDrawn());
+#if !LOG_COLLECTOR
+  Serial.printf("Log upload: segment %u of %u sealed, collector %u\r\n", fileStorage.uploadedSegment(), fileStorage.activeSegment(),
+                uploader.collector());
+#endif
 
   taskShowLogo.restartDelayed();
 }
@@ -425,10 +492,176 @@ void checkDeviceStatus()
 void printLog()
 {
   Serial.println("LOGSTART" + String(mesh.getNodeId()));
-  fileStorage.printFile(LOG_FILE);
+  fileStorage.printLog();
   Serial.println("LOGEND");
 }
 
+// Prints the events kept in RAM by the ring sink
+void printRecentLog()
+{
+  Serial.println("LOGSTART" + String(mesh.getNodeId()));
+  uint8_t pendingNodes = 0;
+  ringSink.forEach([&pendingNodes](const logRecord_t &record) {
+    FileStorage::printRecord(Serial, record, pendingNodes);
+  });
+  if (pendingNodes > 0)
+    Serial.print("]}\r\n");
+  Serial.println("LOGEND");
+}
+
+LogSink *findSink(const String &name)
+{
+  if (name == "file")
+    return &fileStorage.fileSink();
+  if (name == "serial")
+    return &serialSink;
+  if (name == "ring")
+    return &ringSink;
+  if (name == "uplink")
+    return &uplinkSink;
+  return nullptr;
+}
+
+// Broadcasts the records handed over to the uplink sink, a few per package
+void sendLogUplink()
+{
+  if (uplinkSink.size() == 0 || nodes.empty())
+    return;
+
+  logRecord_t records[LOG_UPLINK_PACKAGE_RECORDS];
+  size_t n = 0;
+  while (n < LOG_UPLINK_PACKAGE_RECORDS && uplinkSink.pop(records[n]))
+    n++;
+
+  auto pkg = LogUplinkPackage();
+  pkg.from = mesh.getNodeId();
+  pkg.seq = uplinkSeq;
+  pkg.records = base64::encode((const uint8_t *)records, n * sizeof(logRecord_t));
+  mesh.sendPackage(&pkg);
+  uplinkSeq += n;
+}
+
+#if LOG_COLLECTOR
+// Announces the collector, so the badges start uploading
+void sendCollectorBeacon()
+{
+  auto pkg = LogBeaconPackage();
+  pkg.from = mesh.getNodeId();
+  mesh.sendPackage(&pkg);
+}
+
+bool receivedChunkCallback(protocol::Variant variant)
+{
+  auto pkg = variant.to<LogChunkPackage>();
+
+  uint8_t data[UPLOAD_CHUNK_SIZE];
+  size_t length = 0;
+  if (mbedtls_base64_decode(data, sizeof(data), &length, (const uint8_t *)pkg.data.c_str(), pkg.data.length()) != 0)
+    return true; // too long or broken, the badge sends it again
+
+  auto ack = LogAckPackage();
+  ack.from = mesh.getNodeId();
+  ack.dest = pkg.from;
+  ack.segment = pkg.segment;
+  ack.offset = collector.receive(pkg.from, pkg.segment, pkg.offset, pkg.size, data, length);
+  mesh.sendPackage(&ack);
+  return true;
+}
+#else
+// Uploads the sealed log segments to the collector, holding off while bonding
+void uploadLog()
+{
+  if (currentState == STATE_BONDING)
+    uploader.pause(millis());
+  uploader.update(millis());
+}
+
+void sendLogChunk(uint32_t collector, uint32_t segment, uint32_t offset, uint32_t size, const uint8_t *data, size_t length)
+{
+  auto pkg = LogChunkPackage();
+  pkg.from = mesh.getNodeId();
+  pkg.dest = collector;
+  pkg.segment = segment;
+  pkg.offset = offset;
+  pkg.size = size;
+  pkg.data = base64::encode(data, length);
+  mesh.sendPackage(&pkg);
+}
+
+bool receivedBeaconCallback(protocol::Variant variant)
+{
+  auto pkg = variant.to<LogBeaconPackage>();
+  uploader.collectorSeen(pkg.from, millis());
+  return true;
+}
+
+bool receivedAckCallback(protocol::Variant variant)
+{
+  auto pkg = variant.to<LogAckPackage>();
+  uploader.acknowledged(pkg.from, pkg.segment, pkg.offset);
+  return true;
+}
+#endif
+
+// Commands sent by the host tools in tools/ over the serial port
+void checkSerialCommands()
+{
+  if (!Serial.available())
+    return;
+
+  String command = Serial.readStringUntil('\n');
+  command.trim();
+  if (command == "PRINTLOG")
+  {
+    printLog();
+  }
+  else if (command.startsWith("EXPORT"))
+  {
+    // EXPORT <offset> resumes a broken transfer at offset
+    uint32_t offset = strtoul(command.c_str() + strlen("EXPORT"), nullptr, 10);
+    // Pause the mirror, so it does not print into the binary frames. Records
+    // it got before are printed before the export starts.
+    logLevel_t mirrorLevel = serialSink.level();
+    serialSink.setLevel(LOG_LEVEL_OFF);
+    fileStorage.flush();
+    serialSink.waitIdle(LOG_FLUSH_TIMEOUT);
+    fileStorage.exportLog(Serial, mesh.getNodeId(), offset);
+    serialSink.setLevel(mirrorLevel);
+  }
+  else if (command.startsWith("QUERY"))
+  {
+    // QUERY <type mask> <seconds> prints the events of the types in the mask
+    // (bit 1 << BadgeEvent::EventType) logged within the last seconds
+    char *end;
+    uint16_t types = strtoul(command.c_str() + strlen("QUERY"), &end, 0);
+    uint64_t span = strtoull(end, nullptr, 10) * 1000000ULL;
+    uint64_t now = meshClock.now();
+    Serial.println("LOGSTART" + String(mesh.getNodeId()));
+    fileStorage.printLog(span < now ? now - span : 0, now, types);
+    Serial.println("LOGEND");
+  }
+  else if (command == "RENDERBENCH")
+  {
+    // Compares the render paths of the homescreen, see benchmarkRender()
+    benchmarkRender(Serial);
+  }
+  else if (command == "RECENT")
+  {
+    printRecentLog();
+  }
+  else if (command.startsWith("LEVEL"))
+  {
+    // LEVEL <file|serial|ring|uplink> <level> sets the events a sink receives,
+    // from 0 (none) to 3 (all), see logLevel_t
+    int split = command.indexOf(' ', strlen("LEVEL "));
+    LogSink *sink = split > 0 ? findSink(command.substring(strlen("LEVEL "), split)) : nullptr;
+    if (sink != nullptr)
+    {
+      sink->setLevel((logLevel_t)constrain(command.substring(split + 1).toInt(), LOG_LEVEL_OFF, LOG_LEVEL_ALL));
+    }
+  }
+}
+
 void setTempo()
 {
   //Tell that taps are registered
@@ -444,7 +677,7 @@ void setTempo()
     auto pkg = BeatPackage(mesh.getNodeId(), visualiser.getBeatLength());
     mesh.sendPackage(&pkg);
     currentState = STATE_IDLE;
-    fileStorage.logBeatEvent(mesh.getNodeTime(), visualiser.getBeatLength(), mesh.getNodeId());
+    fileStorage.log(BadgeEvent::beatChanged(meshClock.now(), visualiser.getBeatLength(), mesh.getNodeId()));
     showHomescreen();
   });
   taskSendBPM.restartDelayed();
@@ -477,7 +710,7 @@ void buttonHandler(TouchButtons::InputType keyCode)
     else if (keyCode == TouchButtons::TAP_RIGHT)
     {
       nextPicture();
-      fileStorage.logPictureEvent(mesh.getNodeTime(), getCurrentPicture());
+      fileStorage.log(BadgeEvent::pictureShown(meshClock.now(), getCurrentPicture()));
     }
     else if (keyCode == TouchButtons::HOLD_LEFT)
     {
@@ -518,7 +751,7 @@ void initiateBonding()
   taskBondingPing.setIterations(TASK_FOREVER);
   taskBondingPing.enable();
 
-  bondingCandidates.remove_if([](bondingRequest_t c) { return mesh.getNodeTime() - c.startt > BONDINGTIMEOUT * 1000; }); // clean out old requests
+  bondingCandidates.remove_if([](bondingRequest_t c) { return meshClock.now() - c.startt > BONDINGTIMEOUT * 1000; }); // clean out old requests
   if (bondingCandidates.empty())
   {
     Serial.println("No Valid Requests stored");
@@ -533,7 +766,7 @@ void initiateBonding()
 void initiateBondingHandShake()
 {
   bondingState = BONDING_STARTED;
-  bondingStarttime = mesh.getNodeTime();
+  bondingStarttime = meshClock.now();
   taskBondingPing.enable();
   Serial.printf("initiateBondingHandshake to %u\r\n", bondingCandidate.node);
 }
@@ -551,6 +784,18 @@ void abortBondingSequence() {
   visualiser.blink(300, 3, CRGB::Red); //this one is called 
 }
 
+// Decodes one owned picture into the cache per run, so later homescreens are
+// a plain copy. Stops once all are cached.
+void cachePictures()
+{
+  if (currentState == STATE_BONDING)
+    return;
+  if (pictureCacheComplete())
+    taskCachePictures.disable();
+  else
+    cacheNextPicture();
+}
+
 void completeBondingSequence()
 {
   currentState = STATE_IDLE;
@@ -570,14 +815,16 @@ void completeBondingSequence()
     configuration.pics[configuration.numPics] = candidateCompleted; //fitler for duplicates before storing
     configuration.numPics++;
     fileStorage.saveConfiguration(configuration);
-    fileStorage.printFile(CONFIG_FILE);
+    fileStorage.exportConfiguration(Serial, configuration);
+    invalidatePictureCache();
+    taskCachePictures.enableDelayed(PICTURE_CACHE_INTERVAL);
   }
 
-  fileStorage.logSharingEvent(mesh.getNodeTime(), bondingCandidate.node, candidateCompleted);
+  fileStorage.log(BadgeEvent::shared(meshClock.now(), bondingCandidate.node, candidateCompleted));
 
   Serial.println("Set current picture");
   setCurrentPicture(std::distance(configuration.pics, currentPic));
-  fileStorage.logPictureEvent(mesh.getNodeTime(), getCurrentPicture());
+  fileStorage.log(BadgeEvent::pictureShown(meshClock.now(), getCurrentPicture()));
 
 
   visualiser.blink(500, 3, CRGB::Green); // fill meter
@@ -643,7 +890,7 @@ void sendBondingPing() {
         userFinishBonding();
       }
     case BONDING_STARTED:
-      pkg.starttime = bondingStarttime;
+      pkg.starttime = (uint32_t)bondingStarttime; // packages carry the 32 bit node time
       pkg.progress = ExchangePackage::PROGRESS_START;
       mesh.sendPackage(&pkg);
       
@@ -667,11 +914,11 @@ bool receivedInvitationCallback(protocol::Variant variant)
 
   Serial.printf("Received InvitationPackage from %u\r\n", pkg.from);
 
-  bondingCandidates.remove_if([](bondingRequest_t c) { return mesh.getNodeTime() - c.startt > BONDINGTIMEOUT * 1000; });
+  bondingCandidates.remove_if([](bondingRequest_t c) { return meshClock.now() - c.startt > BONDINGTIMEOUT * 1000; });
   // Add new request to the cue
   bondingRequest_t newCandidate;
   newCandidate.node = pkg.from;
-  newCandidate.startt = mesh.getNodeTime();
+  newCandidate.startt = meshClock.now();
 
   if (currentState != STATE_BONDING) {
       Serial.println("User has not initiated Bonding yet!");
@@ -703,13 +950,13 @@ bool receivedExchangeCallback(protocol::Variant variant)
   {
     if (bondingState == BONDING_STARTED && bondingCandidate.node == pkg.from) // we started first and now
     {
-      bondingCandidate.startt = pkg.starttime;
+      bondingCandidate.startt = meshClock.extend(pkg.starttime);
       initiateBondingSequence();
     }
     else if (bondingState == BONDING_REQUESTED) // if bonding hasnt strted but was requested, skip start and bond immediatly
     {
       bondingCandidate.node = pkg.from;
-      bondingCandidate.startt = pkg.starttime;
+      bondingCandidate.startt = meshClock.extend(pkg.starttime);
       bondingCandidates.push_front(bondingCandidate);
       initiateBondingHandShake();
       initiateBondingSequence();
@@ -783,7 +1030,7 @@ bool receivedBeatCallback(protocol::Variant variant)
   auto pkg = variant.to<BeatPackage>();
 
   Serial.printf("Received BPM %ld from %u\r\n", pkg.beatLength, pkg.from);
-  fileStorage.logBeatEvent(mesh.getNodeTime(), pkg.beatLength, pkg.from);
+  fileStorage.log(BadgeEvent::beatChanged(meshClock.now(), pkg.beatLength, pkg.from));
   visualiser.setBeatLength(pkg.beatLength);
   return true;
 }
@@ -810,8 +1057,7 @@ void newConnectionCallback(uint32_t nodeId)
   Serial.printf("New Connection, nodeId = %u\r\n", nodeId);
   // Serial.printf("--> startHere: New Connection, %s\r\n", mesh.subConnectionJson(true).c_str());
   // Serial.println("");
-  updateNumNodes(nodes.size());
-  if (currentState == STATE_IDLE) showHomescreen();
+  updateNumNodes(nodes.size()); // redraws the status bar of the homescreen
 }
 
 // Called when a change in the connections is registered and control animations based on the change
@@ -821,9 +1067,14 @@ void changedConnectionCallback()
 
   nodes = mesh.getNodeList();
 
-  fileStorage.logConnectionEvent(mesh.getNodeTime(), nodes);
+  uint64_t now = meshClock.now();
+  connectedNodes.assign(nodes.begin(), nodes.end());
+  encounters.update(now, connectedNodes);
+#if LOG_CONNECTIONS
+  fileStorage.logConnectionEvent(now, connectedNodes);
+#endif
 
-  updateNumNodes(nodes.size());
+  updateNumNodes(nodes.size()); // redraws the status bar of the homescreen
   if(nodes.size() > 0)
   {
     calc_delay = true;
@@ -849,11 +1100,17 @@ void changedConnectionCallback()
   {
     visualiser.setProximityStatus(PROXIMITY_ALONE);
   }
-  if (currentState == STATE_IDLE) showHomescreen();
+}
+
+// Logs the encounters changed since the last checkpoint as summary records
+void checkpointEncounters()
+{
+  fileStorage.logEncounters(meshClock.now(), encounters);
 }
 
 void nodeTimeAdjustedCallback(int32_t offset)
 {
+  meshClock.adjust();
   Serial.printf("Adjusted time %u. Offset = %d\r\n", mesh.getNodeTime(), offset);
 }
 
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Arduino.h"
+
+// RGB565 pictures compiled into the firmware from include/ressources by
+// scripts/generate_images.py. Every row is run-length encoded on its own: a
+// control byte c is followed by one pixel repeated (c & 0x7f) + 1 times if
+// bit 7 is set, otherwise by c + 1 literal pixels. Pixels are little endian,
+// as the decoder of the JPEGs delivers them. The arrays stay in flash.
+struct builtinImage_t
+{
+    const char *name; // as the JPEG on the filesystem, without extension
+    uint16_t width;
+    uint16_t height;
+    const uint8_t *data;
+    uint32_t size;
+};
+
+#include "BuiltinImagesData.h"
+
+inline const builtinImage_t *findBuiltinImage(const char *name)
+{
+    for (size_t i = 0; i < BUILTIN_IMAGE_COUNT; i++)
+    {
+        if (strcmp(BUILTIN_IMAGES[i].name, name) == 0)
+        {
+            return &BUILTIN_IMAGES[i];
+        }
+    }
+    return nullptr;
+}
+
+// Decodes the next rows of image from data into pixels, rows * width of them,
+// and returns where the following row starts. Stops at the end of the data,
+// so a broken image cannot overrun pixels.
+inline const uint8_t *decodeBuiltinRows(const builtinImage_t &image, const uint8_t *data, uint16_t rows, uint16_t *pixels)
+{
+    const uint8_t *end = image.data + image.size;
+    uint16_t *last = pixels + rows * image.width;
+    while (pixels < last && data < end)
+    {
+        uint8_t c = *data++;
+        uint16_t count = (c & 0x7f) + 1;
+        if (count > last - pixels)
+            count = last - pixels;
+        if (c & 0x80)
+        {
+            uint16_t pixel = data[0] | data[1] << 8;
+            data += 2;
+            for (uint16_t i = 0; i < count; i++)
+                *pixels++ = pixel;
+        }
+        else
+        {
+            memcpy(pixels, data, count * sizeof(uint16_t));
+            pixels += count;
+            data += ((c & 0x7f) + 1) * sizeof(uint16_t);
+        }
+    }
+    return data;
+}
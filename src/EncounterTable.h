@@ -0,0 +1,132 @@
+#pragma once
+
+// Does not depend on the Arduino core, like NodeSet.h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include "NodeSet.h"
+
+#ifndef ENCOUNTER_MAX_PEERS
+#define ENCOUNTER_MAX_PEERS 128 // peers tracked since boot, further ones are counted as dropped
+#endif
+
+// Co-presence with one peer. Times are extended node times in us.
+struct encounter_t
+{
+    uint32_t node;
+    uint16_t count;     // separate encounters
+    bool present;       // currently connected
+    bool changed;       // since the last checkpoint
+    uint64_t firstSeen;
+    uint64_t lastSeen;
+    uint64_t since;     // start of the current encounter
+    uint64_t duration;  // co-presence of the closed encounters
+
+    uint64_t totalDuration(uint64_t now) const
+    {
+        return duration + (present ? now - since : 0);
+    }
+};
+
+// Aggregates the connection changes into one entry per peer, sorted by node
+// id. A peer coming back within mergeGap continues its previous encounter,
+// so a flapping mesh connection does not count as many short ones.
+class EncounterTable
+{
+public:
+    explicit EncounterTable(uint64_t mergeGap) : _mergeGap(mergeGap) {}
+
+    size_t size() const { return _size; }
+    size_t dropped() const { return _dropped; }
+    const encounter_t *begin() const { return _entries; }
+    const encounter_t *end() const { return _entries + _size; }
+
+    const encounter_t *find(uint32_t node) const
+    {
+        const encounter_t *pos = lowerBound(node);
+        return pos != end() && pos->node == node ? pos : nullptr;
+    }
+
+    // Applies the connected peers at time
+    void update(uint64_t time, const NodeSet &connected)
+    {
+        for (encounter_t *e = _entries; e != _entries + _size; e++)
+        {
+            if (e->present && !connected.contains(e->node))
+            {
+                e->present = false;
+                e->duration += time - e->since;
+                e->lastSeen = time;
+                e->changed = true;
+            }
+        }
+
+        for (uint32_t node : connected)
+        {
+            encounter_t *e = insert(node, time);
+            if (e == nullptr)
+            {
+                continue;
+            }
+            if (!e->present)
+            {
+                if (e->count == 0 || time - e->lastSeen > _mergeGap)
+                {
+                    e->count += e->count < UINT16_MAX;
+                }
+                e->present = true;
+                e->since = time;
+                e->changed = true;
+            }
+            e->lastSeen = time;
+        }
+    }
+
+    // Calls f(entry) for every entry changed since the last call, including
+    // all present peers, whose duration grows by the minute
+    template <typename F>
+    void checkpoint(F f)
+    {
+        for (encounter_t *e = _entries; e != _entries + _size; e++)
+        {
+            if (e->changed || e->present)
+            {
+                f(*e);
+                e->changed = false;
+            }
+        }
+    }
+
+private:
+    encounter_t _entries[ENCOUNTER_MAX_PEERS];
+    size_t _size = 0;
+    size_t _dropped = 0;
+    uint64_t _mergeGap;
+
+    const encounter_t *lowerBound(uint32_t node) const
+    {
+        return std::lower_bound(begin(), end(), node, [](const encounter_t &e, uint32_t n) { return e.node < n; });
+    }
+
+    encounter_t *insert(uint32_t node, uint64_t time)
+    {
+        encounter_t *pos = const_cast<encounter_t *>(lowerBound(node));
+        if (pos != _entries + _size && pos->node == node)
+        {
+            return pos;
+        }
+        if (_size == ENCOUNTER_MAX_PEERS)
+        {
+            _dropped++;
+            return nullptr;
+        }
+        std::copy_backward(pos, _entries + _size, _entries + _size + 1);
+        _size++;
+        *pos = encounter_t();
+        pos->node = node;
+        pos->firstSeen = time;
+        pos->lastSeen = time;
+        return pos;
+    }
+};
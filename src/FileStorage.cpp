@@ -1,5 +1,5 @@
 #include "FileStorage.h"
-#include <StreamUtils.h>
+#include "BadgeRoster.h"
 #include <time.h>
 #include <sys/time.h>
 
@@ -10,11 +10,50 @@ unsigned long getTime()
     return now;
 }
 
+static size_t fileSize(const char *filename)
+{
+    if (!STORAGE.exists(filename))
+    {
+        return 0;
+    }
+    fs::File file = STORAGE.open(filename);
+    size_t size = file ? file.size() : 0;
+    file.close();
+    return size;
+}
+
+// Mounts the filesystem, takes stock of its usage and starts logging
+bool FileStorage::begin()
+{
+    if (!STORAGE.begin())
+    {
+        return false;
+    }
+
+    _usedBytes = STORAGE.usedBytes();
+    _totalBytes = STORAGE.totalBytes();
+    for (uint8_t slot = 0; slot < CONFIG_SLOTS; slot++)
+    {
+        char path[LOG_PATH_LENGTH];
+        configSlotPath(path, slot);
+        _configSize[slot] = fileSize(path);
+    }
+
+    loadFlashStats();
+    _segmentLock = xSemaphoreCreateMutex();
+    loadManifest();
+    restoreIndex();
+    loadUploadState();
+
+    startLogTask();
+    return true;
+}
+
 // Prints the content of a file to the Serial
 void FileStorage::printFile(const char *filename)
 {
     // Open file for reading
-    fs::File file = SPIFFS.open(filename);
+    fs::File file = STORAGE.open(filename);
     if (!file)
     {
         Serial.println(F("Failed to read file"));
@@ -34,66 +73,146 @@ void FileStorage::printFile(const char *filename)
 
 bool FileStorage::initConfiguration(badgeConfig_t &config, uint32_t nodeid)
 {
-    // Open file for reading
-    fs::File file = SPIFFS.open(BADGES_FILE);
+    // The roster compiled into the firmware resolves the badge without parsing
+    const rosterEntry_t *entry = findRosterEntry(nodeid);
+    if (entry != nullptr)
+    {
+        config.color = entry->color;
+        config.numPics = NUM_PICS;
+        std::copy(entry->pics, entry->pics + NUM_PICS, config.pics);
 
-    // Allocate a temporary JsonDocument
-    // Don't forget to change the capacity to match your requirements.
-    // Use arduinojson.org/v6/assistant to compute the capacity.
-    StaticJsonDocument<BADGES_MEMORY> doc;
+        const uint32_t *members = rosterGroupMembers(*entry);
+        size_t n = 0;
+        for (size_t i = 0; i < entry->groupSize && n < MAX_GROUP_SIZE; i++)
+        {
+            if (members[i] != nodeid)
+            {
+                config.group[n++] = members[i];
+            }
+        }
+        std::fill(config.group + n, config.group + MAX_GROUP_SIZE, 0);
 
-    DeserializationError error = deserializeJson(doc, file);
-    // Deserialize the JSON document
+        saveConfiguration(config);
+        return true;
+    }
+
+    // Badges missing in the compiled roster are looked up in BADGES_FILE
+    return importRoster(config, nodeid);
+}
+
+bool FileStorage::importRoster(badgeConfig_t &config, uint32_t nodeid)
+{
+    // Open file for reading
+    fs::File file = STORAGE.open(BADGES_FILE);
+    if (!file)
+    {
+        Serial.println(F("Failed to open roster, using default configuration"));
+        return false;
+    }
+
+    // The roster is streamed element by element, so its size is not limited by RAM
+    badges_t badge;
+    bool found;
+    DeserializationError error = importRosterEntry(
+        file, [&file]() { file.seek(0); }, nodeid, badge, config.group, MAX_GROUP_SIZE, found);
+    file.close();
     if (error)
     {
-        Serial.println(F("Failed to read file, using default configuration"));
+        Serial.print(F("Failed to read roster, using default configuration: "));
         Serial.println(error.c_str());
-        file.close();
+        return false;
+    }
+    if (!found)
+    {
+        Serial.println(F("Badge not found in roster, using default configuration"));
         return false;
     }
 
-    // Iterate over all possible configruations
-    uint8_t groupid;
-    for (JsonObject elem : doc.as<JsonArray>())
+    config.color = badge.color;
+    config.numPics = NUM_PICS;
+    for (size_t i = 0; i < NUM_PICS; i++)
     {
-        //Check if this is this is the configuration for this device
-        if (elem[CONFIG_KEY_ID] == nodeid) 
-        {
-            // Copy values from the JsonDocument to the Config
-            groupid = elem[CONFIG_KEY_GROUP];
-            config.color = (uint32_t) strtol(elem[CONFIG_KEY_COLOR], 0, 16);
-            config.numPics = NUM_PICS;
-            JsonArray pics = elem[CONFIG_KEY_PICS];
-            for (size_t i = 0; i < NUM_PICS; i++)
-            {
-                config.pics[i] = pics[i];
-            }
-            break; // stop iterating, because we found the config
-        }
+        config.pics[i] = badge.pics[i];
     }
 
-    size_t n = 0;
-    for (JsonObject elem : doc.as<JsonArray>())
+    saveConfiguration(config);
+
+    return true;
+}
+
+// Loads the configuration from the binary snapshot with a single read. Falls
+// back to importing CONFIG_FILE, e.g. after the snapshot format changed.
+bool FileStorage::loadConfiguration(badgeConfig_t &config)
+{
+    if (loadSnapshot(config))
+    {
+        return true;
+    }
+    if (!importConfiguration(config))
+    {
+        return false;
+    }
+    saveConfiguration(config);
+    return true;
+}
+
+void FileStorage::configSlotPath(char *path, uint8_t slot)
+{
+    snprintf(path, LOG_PATH_LENGTH, CONFIG_SLOT_FILE, slot);
+}
+
+// Picks the newest valid snapshot of all slots
+bool FileStorage::loadSnapshot(badgeConfig_t &config)
+{
+    bool found = false;
+    configSnapshot_t snapshot;
+    for (uint8_t slot = 0; slot < CONFIG_SLOTS; slot++)
     {
-        //Check if this is this is a node in the group but not itself
-        if (elem[CONFIG_KEY_GROUP] == groupid && elem[CONFIG_KEY_ID] != nodeid)
+        if (!readSnapshot(slot, snapshot))
+        {
+            continue;
+        }
+        // Generations are compared by difference so they may wrap around
+        if (!found || (int32_t)(snapshot.generation - _configGeneration) > 0)
         {
-            // Add the id values from the JsonDocument to the config
-            config.group[n++] = elem[CONFIG_KEY_ID];
+            found = true;
+            config = snapshot.config;
+            _configSlot = slot;
+            _configGeneration = snapshot.generation;
         }
     }
+    return found;
+}
 
-    file.close();
+bool FileStorage::readSnapshot(uint8_t slot, configSnapshot_t &snapshot)
+{
+    char path[LOG_PATH_LENGTH];
+    configSlotPath(path, slot);
+    if (!STORAGE.exists(path))
+    {
+        return false;
+    }
 
-    saveConfiguration(config);
+    fs::File file = STORAGE.open(path);
+    bool valid = file.read((uint8_t *)&snapshot, sizeof(snapshot)) == sizeof(snapshot) &&
+                 snapshot.magic == CONFIG_SNAPSHOT_MAGIC &&
+                 snapshot.version == CONFIG_SNAPSHOT_VERSION &&
+                 snapshot.size == sizeof(badgeConfig_t) &&
+                 snapshot.crc == logCrc32((const uint8_t *)&snapshot, offsetof(configSnapshot_t, crc));
+    file.close();
 
-    return true;
+    if (!valid)
+    {
+        Serial.printf("Invalid configuration snapshot %s\r\n", path);
+    }
+    return valid;
 }
 
-bool FileStorage::loadConfiguration(badgeConfig_t &config)
+// Reads the configuration from the JSON file CONFIG_FILE
+bool FileStorage::importConfiguration(badgeConfig_t &config)
 {
     // Open file for reading
-    fs::File file = SPIFFS.open(CONFIG_FILE);
+    fs::File file = STORAGE.open(CONFIG_FILE);
 
     // Allocate a temporary JsonDocument
     // Don't forget to change the capacity to match your requirements.
@@ -130,20 +249,52 @@ bool FileStorage::loadConfiguration(badgeConfig_t &config)
     return true;
 }
 
-// Saves the configuration to a file
+// Saves the configuration as a binary snapshot. It overwrites the older slot
+// only, so an interrupted save leaves the previous snapshot intact.
 void FileStorage::saveConfiguration(const badgeConfig_t &config)
 {
-    // Delete existing file, otherwise the configuration is appended to the file
-    SPIFFS.remove(CONFIG_FILE);
+    configSnapshot_t snapshot = {};
+    snapshot.magic = CONFIG_SNAPSHOT_MAGIC;
+    snapshot.version = CONFIG_SNAPSHOT_VERSION;
+    snapshot.size = sizeof(badgeConfig_t);
+    snapshot.generation = _configGeneration + 1;
+    snapshot.config = config;
+    snapshot.crc = logCrc32((const uint8_t *)&snapshot, offsetof(configSnapshot_t, crc));
+
+    uint8_t slot = (_configSlot + 1) % CONFIG_SLOTS;
+    char path[LOG_PATH_LENGTH];
+    configSlotPath(path, slot);
 
-    // Open file for writing
-    fs::File file = SPIFFS.open(CONFIG_FILE, FILE_WRITE);
+    // Open file for writing, replacing the older snapshot
+    uint32_t started = micros();
+    fs::File file = STORAGE.open(path, FILE_WRITE);
     if (!file)
     {
         Serial.println(F("Failed to create file"));
         return;
     }
 
+    size_t size = file.write((const uint8_t *)&snapshot, sizeof(snapshot));
+    file.close();
+    _flashStats.record(FLASH_OP_CONFIG, size, micros() - started);
+
+    _usedBytes += size;
+    _usedBytes -= _configSize[slot];
+    _configSize[slot] = size;
+
+    if (size != sizeof(snapshot))
+    {
+        // The incomplete slot fails its check, the newest snapshot stays where it was
+        Serial.println(F("Failed to write to file"));
+        return;
+    }
+    _configSlot = slot;
+    _configGeneration = snapshot.generation;
+}
+
+// Prints the configuration in the JSON format of CONFIG_FILE
+void FileStorage::exportConfiguration(Print &out, const badgeConfig_t &config)
+{
     // Allocate a temporary JsonDocument
     // Don't forget to change the capacity to match your requirements.
     // Use arduinojson.org/assistant to compute the capacity.
@@ -162,131 +313,1189 @@ void FileStorage::saveConfiguration(const badgeConfig_t &config)
         groupnodes.add(config.group[i]);
     }
 
-    // Serialize JSON to file
-    if (serializeJson(doc, file) == 0)
+    serializeJson(doc, out);
+    out.println();
+}
+
+// Logs an event that carries no node list. Costs the event and one record on
+// the stack of the caller.
+void FileStorage::log(const BadgeEvent &event)
+{
+    logRecord_t record = logEncodeEvent(event, getTime());
+    logEvent(&record, 1);
+}
+
+// Writes a summary record for every peer whose encounters changed since the
+// last checkpoint
+void FileStorage::logEncounters(const uint64_t time, EncounterTable &table)
+{
+    logRecord_t records[LOG_DELTA_CHUNK];
+    size_t n = 0;
+    table.checkpoint([&](const encounter_t &e) {
+        BadgeEvent event = BadgeEvent::encountered(e.present ? time : e.lastSeen, e.node, e.count, e.firstSeen, e.totalDuration(time));
+        records[n++] = logEncodeEvent(event, 0);
+        if (n == LOG_DELTA_CHUNK)
+        {
+            logEvent(records, n);
+            n = 0;
+        }
+    });
+    if (n > 0)
     {
-        Serial.println(F("Failed to write to file"));
+        logEvent(records, n);
     }
+}
 
-    // Close the file
-    file.close();
+// Calls f(node, joined) for every node that joined or left between two snapshots
+template <typename F>
+static size_t forEachChange(const NodeSet &before, const NodeSet &after, F f)
+{
+    size_t changes = 0;
+    const uint32_t *b = before.begin();
+    const uint32_t *a = after.begin();
+    while (b != before.end() || a != after.end())
+    {
+        if (a == after.end() || (b != before.end() && *b < *a))
+        {
+            f(*b++, false);
+        }
+        else if (b == before.end() || *a < *b)
+        {
+            f(*a++, true);
+        }
+        else
+        {
+            a++;
+            b++;
+            continue;
+        }
+        changes++;
+    }
+    return changes;
 }
 
-void FileStorage::logBootEvent(const uint32_t time)
+// Logs the joins and leaves against the previous snapshot, or a full snapshot
+// every LOG_KEYFRAME_INTERVAL changes and whenever it is the smaller record.
+// Keyframes are encoded straight into the queue, so the stack cost is bounded
+// by LOG_DELTA_CHUNK records whatever the number of nodes.
+void FileStorage::logConnectionEvent(const uint64_t time, const NodeSet &nodes)
 {
-    // Allocate a temporary JsonDocument
-    // Don't forget to change the capacity to match your requirements.
-    // Use arduinojson.org/assistant to compute the capacity.
-    StaticJsonDocument<LOG_MEMORY> doc;
+    const uint32_t date = getTime();
+
+    const size_t keyframeSize = logConnectionRecords(nodes.size());
+    const size_t changes = forEachChange(_connectedNodes, nodes, [](uint32_t, bool) {});
+
+    bool queued = true;
+    if (_changesSinceKeyframe >= LOG_KEYFRAME_INTERVAL || changes >= keyframeSize)
+    {
+        queued = logRecords(keyframeSize, [&](size_t i, logRecord_t &record) {
+            connectionRecord(record, i, time, date, nodes);
+        });
+        _changesSinceKeyframe = 0;
+    }
+    else if (changes > 0)
+    {
+        logRecord_t records[LOG_DELTA_CHUNK];
+        size_t n = 0;
+        forEachChange(_connectedNodes, nodes, [&](uint32_t node, bool joined) {
+            records[n] = logEncodeEvent(BadgeEvent::nodeChanged(time, node, joined), date);
+            if (++n == LOG_DELTA_CHUNK)
+            {
+                queued &= logEvent(records, n);
+                n = 0;
+            }
+        });
+        if (n > 0)
+        {
+            queued &= logEvent(records, n);
+        }
+        _changesSinceKeyframe++;
+    }
+
+    // Later deltas would apply to a snapshot missing from the log, so the
+    // next change is logged as a keyframe
+    if (!queued)
+    {
+        _changesSinceKeyframe = LOG_KEYFRAME_INTERVAL;
+    }
+    _connectedNodes = nodes;
+}
 
-    doc["t"] = time;
-    doc["s"] = getTime();
-    doc["e"] = BadgeEvent::POWER_EVT;
+// Fills the record at index of a connection event listing all nodes
+void FileStorage::connectionRecord(logRecord_t &record, size_t index, uint64_t time, uint32_t date, const NodeSet &nodes)
+{
+    if (index == 0)
+    {
+        record = logEncodeEvent(BadgeEvent::connection(time, nodes.size()), date);
+        return;
+    }
 
-    logEvent(doc);
+    record = {};
+    record.type = LOG_RECORD_CONTINUATION;
+    const uint32_t *node = nodes.begin() + (index - 1) * LOG_NODES_PER_RECORD;
+    for (size_t i = 0; i < LOG_NODES_PER_RECORD && node != nodes.end(); i++)
+    {
+        record.nodes[i] = *node++;
+    }
 }
 
-void FileStorage::logBeatEvent(const uint32_t time, const int32_t &beat, const uint32_t &node) {
-    // Allocate a temporary JsonDocument
-    // Don't forget to change the capacity to match your requirements.
-    // Use arduinojson.org/assistant to compute the capacity.
-    StaticJsonDocument<LOG_MEMORY> doc;
+// Hands the records of an event over to the logging task. Must only be called
+// from the Arduino loop (mesh callbacks and scheduler tasks), as the queue
+// supports a single producer. Never touches the flash. Returns false if the
+// queue was full and the records were dropped.
+bool FileStorage::logEvent(const logRecord_t *records, size_t count)
+{
+    return logRecords(count, [records](size_t i, logRecord_t &record) {
+        record = records[i];
+    });
+}
 
-    doc["t"] = time;
-    doc["s"] = getTime();
-    doc["e"] = BadgeEvent::BEAT_EVT;
-    if (node != 0) doc["n"] = node;
-    doc["b"] = beat;
+// Like logEvent(), with the records written in place by fill(index, record)
+template <typename F>
+bool FileStorage::logRecords(size_t count, F fill)
+{
+    bool queued = _logQueue.emplace(count, [&fill](size_t i, logRecord_t &record) {
+        fill(i, record);
+        logRecordSeal(record);
+    });
+    if (!queued)
+    {
+        _droppedRecords += count;
+        return false;
+    }
+    if (_logTask != nullptr)
+    {
+        xTaskNotifyGive(_logTask);
+    }
+    return true;
+}
 
-    logEvent(doc);
+// Starts the task that writes the log, pinned to the core not running the mesh
+void FileStorage::startLogTask()
+{
+    if (_logTask != nullptr)
+    {
+        return;
+    }
+    _flushed = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(logTask, "logTask", LOG_TASK_STACK, this, LOG_TASK_PRIORITY, &_logTask, LOG_TASK_CORE);
 }
 
-void FileStorage::logPictureEvent(const uint32_t time, const int8_t &pic) {
-    // Allocate a temporary JsonDocument
-    // Don't forget to change the capacity to match your requirements.
-    // Use arduinojson.org/assistant to compute the capacity.
-    StaticJsonDocument<LOG_MEMORY> doc;
+void FileStorage::logTask(void *param)
+{
+    static_cast<FileStorage *>(param)->processLog();
+}
+
+// Collects records in RAM and writes them in batches, because every
+// open/close of the log file costs tens of milliseconds on SPIFFS
+void FileStorage::processLog()
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_TASK_WAKEUP));
 
-    doc["t"] = time;
-    doc["s"] = getTime();
-    doc["e"] = BadgeEvent::PICTURE_EVT;
-    doc["p"] = pic;
+        // Taken before draining, so a flush covers all records queued before it
+        const uint32_t requested = _flushRequests;
+        drainQueue();
+
+        if (requested != _flushesDone)
+        {
+            flushSinks();
+            saveFlashStats();
+            _flushesDone = requested;
+            xSemaphoreGive(_flushed);
+        }
+        else if (_bufferedRecords > 0 && millis() - _oldestBufferedAt >= LOG_FLUSH_AGE)
+        {
+            flushBuffer();
+        }
 
-    logEvent(doc);
+        if (millis() - _flashStatsSavedAt >= FLASH_STATS_SAVE_INTERVAL)
+        {
+            saveFlashStats();
+        }
+    }
 }
 
-void FileStorage::logSharingEvent(const uint32_t time, const uint32_t &node, const int8_t &pic)
+// Passes the queued records to the sinks. All records of an event go to the
+// sinks whose level included the event when its first record was drained.
+void FileStorage::drainQueue()
 {
-    // Allocate a temporary JsonDocument
-    // Don't forget to change the capacity to match your requirements.
-    // Use arduinojson.org/assistant to compute the capacity.
-    StaticJsonDocument<LOG_MEMORY> doc;
+    logRecord_t record;
+    while (_logQueue.pop(record))
+    {
+        if (record.type != LOG_RECORD_CONTINUATION)
+        {
+            const logLevel_t level = logEventLevel(record.type);
+            _deliverTo = 0;
+            for (size_t i = 0; i < LOG_MAX_SINKS; i++)
+            {
+                LogSink *sink = _sinks[i];
+                if (sink != nullptr && level <= sink->level())
+                {
+                    _deliverTo |= 1 << i;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < LOG_MAX_SINKS; i++)
+        {
+            LogSink *sink = _sinks[i];
+            if (sink != nullptr && (_deliverTo & (1 << i)))
+            {
+                sink->write(record);
+            }
+        }
+    }
+}
+
+void FileStorage::flushSinks()
+{
+    for (size_t i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        LogSink *sink = _sinks[i];
+        if (sink != nullptr)
+        {
+            sink->flush();
+        }
+    }
+}
 
-    doc["t"] = time;
-    doc["s"] = getTime();
-    doc["e"] = BadgeEvent::SHARE_EVT;
-    doc["n"] = node;
-    doc["p"] = pic;
+// Registers a sink for the records logged from now on. Sinks must outlive
+// the FileStorage, as the logging task may still use a removed sink.
+bool FileStorage::addSink(LogSink &sink)
+{
+    for (size_t i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        LogSink *expected = nullptr;
+        if (_sinks[i].compare_exchange_strong(expected, &sink))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
-    logEvent(doc);
+void FileStorage::removeSink(LogSink &sink)
+{
+    for (size_t i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        LogSink *expected = &sink;
+        _sinks[i].compare_exchange_strong(expected, nullptr);
+    }
 }
 
-void FileStorage::logConnectionEvent(const uint32_t time, const SimpleList<uint32_t> &nodes)
+// Moves a record into the write buffer
+void FileStorage::bufferRecord(const logRecord_t &record)
 {
-    // Allocate a temporary JsonDocument
-    // Don't forget to change the capacity to match your requirements.
-    // Use arduinojson.org/assistant to compute the capacity.
-    StaticJsonDocument<LOG_MEMORY> doc;
+    // Keep all records of an event in the same batch and thus segment
+    if (record.type != LOG_RECORD_CONTINUATION && _bufferedRecords + logEventRecords(record) > LOG_BUFFER_RECORDS)
+    {
+        flushBuffer();
+    }
+
+    if (_bufferedRecords == 0)
+    {
+        _oldestBufferedAt = millis();
+    }
+    _logBuffer[_bufferedRecords++] = record;
+    if (_bufferedRecords >= LOG_BUFFER_RECORDS)
+    {
+        flushBuffer();
+    }
+}
 
-    doc["t"] = time;
-    doc["s"] = getTime();
-    doc["e"] = BadgeEvent::CONNECTION_EVT;
+void LogFileSink::write(const logRecord_t &record)
+{
+    _storage.bufferRecord(record);
+}
 
-    nodes.begin();
+void LogFileSink::flush()
+{
+    _storage.flushBuffer();
+}
 
-    // Set the values in the document
-    JsonArray nodesArr = doc.createNestedArray("n");
-    SimpleList<uint32_t>::const_iterator node = nodes.begin();
-    while (node != nodes.end())
+// Writes all queued and buffered records to the log file and waits until the
+// logging task is done. Use before the RAM is lost, e.g. before deep sleep.
+void FileStorage::flush()
+{
+    if (_logTask == nullptr)
+    {
+        // No concurrent consumer, so the queue can be drained right here
+        drainQueue();
+        flushSinks();
+        saveFlashStats();
+        return;
+    }
+
+    const uint32_t request = ++_flushRequests;
+    xTaskNotifyGive(_logTask);
+    const uint32_t started = millis();
+    while ((int32_t)(_flushesDone - request) < 0)
     {
-        nodesArr.add(*node);
-        node++;
+        const uint32_t waited = millis() - started;
+        if (waited >= LOG_FLUSH_TIMEOUT || xSemaphoreTake(_flushed, pdMS_TO_TICKS(LOG_FLUSH_TIMEOUT - waited)) != pdTRUE)
+        {
+            Serial.println(F("Warning: Flushing the log timed out"));
+            return;
+        }
     }
+}
 
-    logEvent(doc);
+void FileStorage::flushBuffer()
+{
+    if (_bufferedRecords == 0)
+    {
+        return;
+    }
+    writeRecords(_logBuffer, _bufferedRecords);
+    _bufferedRecords = 0;
 }
 
-void FileStorage::logEvent(const StaticJsonDocument<LOG_MEMORY> &doc)
+void FileStorage::writeRecords(const logRecord_t *records, size_t count)
 {
+    const size_t length = count * sizeof(logRecord_t);
+
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+
+    // Keep the cost of an append constant by starting a new segment. A new
+    // segment starts with a header and a keyframe, which count as well.
+    if (_activeSize > 0 && _activeSize + length > LOG_SEGMENT_SIZE)
+    {
+        sealSegment();
+    }
+    const size_t needed = length + (_activeSize == 0 ? sizeof(logRecord_t) + keyframeLength() : 0);
+
+    // Make room according to the retention policy
+    while ((LOG_MAX_SEGMENTS > 0 && _activeSegment - _firstSegment >= LOG_MAX_SEGMENTS) ||
+           (LOG_RECYCLE_SEGMENTS && _usedBytes + needed > LOGGING_LIMIT))
+    {
+        if (!recycleSegment())
+        {
+            break;
+        }
+    }
 
-    // Time recorded for test purposes
-    // uint32_t t = millis();
-    
-    if (SPIFFS.usedBytes() > LOGGING_LIMIT) {
+    if (_usedBytes + needed > LOGGING_LIMIT) {
+        xSemaphoreGive(_segmentLock);
         Serial.println(F("Warning: Filesystem full. Logging halted."));
         return;
     }
 
-    fs::File logFile = SPIFFS.open(LOG_FILE, FILE_APPEND);
+    char path[LOG_PATH_LENGTH];
+    segmentPath(path, _activeSegment);
+    uint32_t started = micros();
+    fs::File logFile = STORAGE.open(path, FILE_APPEND);
     if (!logFile)
     {
+        xSemaphoreGive(_segmentLock);
         Serial.println("- failed to open log file");
         return;
     }
 
-    WriteLoggingStream loggedFile(logFile, Serial);
-    // Serialize JSON to file
-    if (serializeJson(doc, loggedFile) == 0)
+    size_t written = 0;
+
+    // Every segment starts with a header and the current connection
+    // snapshot, so it can be read and replayed on its own
+    if (_activeSize == 0)
+    {
+        logRecord_t header = logHeaderRecord(_activeSegment);
+        written += logFile.write((const uint8_t *)&header, sizeof(header));
+        indexRecord(header);
+        written += writeKeyframe(logFile);
+    }
+
+    size_t appended = logFile.write((const uint8_t *)records, length);
+    if (appended != length)
     {
         Serial.println("File write failed");
     }
-    logFile.println();
+    written += appended;
+    for (size_t i = 0; i < appended / sizeof(logRecord_t); i++)
+    {
+        indexRecord(records[i]);
+    }
 
     // Close the file
     logFile.close();
+    _flashStats.record(FLASH_OP_LOG, written, micros() - started);
 
-    // How much time did writing to the log take
-    // t = millis() - t;
-    // Serial.print(t);
-    // Serial.println(" ms");
-}
\ No newline at end of file
+    _activeSize += written;
+    _logSize += written;
+    _usedBytes += written;
+
+    xSemaphoreGive(_segmentLock);
+
+    replayConnections(records, count);
+}
+
+// Writes the replayed connection snapshot as a keyframe
+// Bytes writeKeyframe() would write now
+size_t FileStorage::keyframeLength() const
+{
+    return _replayValid ? logConnectionRecords(_replayNodes.size()) * sizeof(logRecord_t) : 0;
+}
+
+size_t FileStorage::writeKeyframe(fs::File &file)
+{
+    if (!_replayValid)
+    {
+        return 0;
+    }
+
+    size_t written = 0;
+    const size_t numRecords = logConnectionRecords(_replayNodes.size());
+    for (size_t i = 0; i < numRecords; i++)
+    {
+        logRecord_t record;
+        connectionRecord(record, i, _replayTime, _replayDate, _replayNodes);
+        logRecordSeal(record);
+        written += file.write((const uint8_t *)&record, sizeof(record));
+        indexRecord(record);
+    }
+    return written;
+}
+
+// Follows the connection records written to the log, as a reader would
+void FileStorage::replayConnections(const logRecord_t *records, size_t count)
+{
+    size_t pendingNodes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const logRecord_t &record = records[i];
+        switch (record.type)
+        {
+        case BadgeEvent::CONNECTION_EVT:
+            _replayNodes.clear();
+            _replayValid = true;
+            pendingNodes = record.arg;
+            break;
+        case LOG_RECORD_CONTINUATION:
+            for (size_t n = 0; n < LOG_NODES_PER_RECORD && pendingNodes > 0; n++, pendingNodes--)
+            {
+                _replayNodes.insert(record.nodes[n]);
+            }
+            continue;
+        case BadgeEvent::NODE_JOIN_EVT:
+            _replayNodes.insert(record.event.node);
+            break;
+        case BadgeEvent::NODE_LEAVE_EVT:
+            _replayNodes.remove(record.event.node);
+            break;
+        default:
+            continue;
+        }
+        _replayTime = record.event.time;
+        _replayDate = record.event.date;
+    }
+}
+
+void FileStorage::segmentPath(char *path, uint32_t segment)
+{
+    snprintf(path, LOG_PATH_LENGTH, LOG_SEGMENT_FILE, segment);
+}
+
+// Restores the segment range from the manifest. Without a valid manifest the
+// range is recovered from the segment files present on the filesystem.
+void FileStorage::loadManifest()
+{
+    logManifest_t manifest = {};
+    bool valid = false;
+    if (STORAGE.exists(LOG_MANIFEST_FILE))
+    {
+        fs::File file = STORAGE.open(LOG_MANIFEST_FILE);
+        valid = file.read((uint8_t *)&manifest, sizeof(manifest)) == sizeof(manifest) &&
+                manifest.magic == LOG_MANIFEST_MAGIC &&
+                manifest.crc == logManifestCrc(manifest) &&
+                manifest.first <= manifest.active;
+        file.close();
+    }
+
+    if (!valid)
+    {
+        Serial.println(F("No valid log manifest, scanning for segments"));
+        manifest.first = UINT32_MAX;
+        manifest.active = 0;
+        fs::File root = STORAGE.open("/");
+        fs::File file = root.openNextFile();
+        while (file)
+        {
+            // Depending on the core version names come with or without the leading slash
+            unsigned int segment;
+            const char *name = file.name();
+            if (name[0] == '/')
+                name++;
+            if (sscanf(name, &LOG_SEGMENT_FILE[1], &segment) == 1)
+            {
+                manifest.first = std::min(manifest.first, (uint32_t)segment);
+                manifest.active = std::max(manifest.active, (uint32_t)segment);
+            }
+            file.close();
+            file = root.openNextFile();
+        }
+        root.close();
+        if (manifest.first == UINT32_MAX)
+        {
+            manifest.first = 0;
+        }
+    }
+
+    _firstSegment = manifest.first;
+    _activeSegment = manifest.active;
+
+    // The only time all segments are opened to sum up their sizes
+    char path[LOG_PATH_LENGTH];
+    _logSize = 0;
+    for (uint32_t segment = _firstSegment; segment <= _activeSegment; segment++)
+    {
+        segmentPath(path, segment);
+        _logSize += fileSize(path);
+    }
+    _activeSize = fileSize(path);
+
+    // Records of a new format version never continue a segment of the old one
+    if (valid && manifest.version != LOG_FORMAT_VERSION && _activeSize > 0)
+    {
+        Serial.println(F("Log format changed, starting a new segment"));
+        sealSegment();
+    }
+    else if (!valid)
+    {
+        saveManifest();
+    }
+}
+
+void FileStorage::saveManifest()
+{
+    logManifest_t manifest = {};
+    manifest.magic = LOG_MANIFEST_MAGIC;
+    manifest.first = _firstSegment;
+    manifest.active = _activeSegment;
+    manifest.version = LOG_FORMAT_VERSION;
+    manifest.crc = logManifestCrc(manifest);
+
+    uint32_t started = micros();
+    fs::File file = STORAGE.open(LOG_MANIFEST_FILE, FILE_WRITE);
+    if (!file || file.write((const uint8_t *)&manifest, sizeof(manifest)) != sizeof(manifest))
+    {
+        Serial.println(F("Failed to write log manifest"));
+    }
+    file.close();
+    _flashStats.record(FLASH_OP_MANIFEST, sizeof(manifest), micros() - started);
+}
+
+// Continues the flash statistics saved before the reset
+void FileStorage::loadFlashStats()
+{
+    flashStats_t saved = {};
+    bool read = false;
+    if (STORAGE.exists(FLASH_STATS_FILE))
+    {
+        fs::File file = STORAGE.open(FLASH_STATS_FILE);
+        read = file.read((uint8_t *)&saved, sizeof(saved)) == sizeof(saved);
+        _flashStatsSize = file.size();
+        file.close();
+    }
+    _flashStats.begin(read ? &saved : nullptr);
+}
+
+// Saves the statistics if filesystem operations were recorded since they were
+// saved last, so read-only flushes, e.g. before a query, write nothing
+void FileStorage::saveFlashStats()
+{
+    _flashStatsSavedAt = millis();
+    flashStats_t stats;
+    if (!_flashStats.unsavedSnapshot(stats))
+    {
+        return;
+    }
+    uint32_t started = micros();
+    fs::File file = STORAGE.open(FLASH_STATS_FILE, FILE_WRITE);
+    size_t size = file ? file.write((const uint8_t *)&stats, sizeof(stats)) : 0;
+    file.close();
+    _flashStats.record(FLASH_OP_STATS, size, micros() - started);
+    _usedBytes += size;
+    _usedBytes -= _flashStatsSize;
+    _flashStatsSize = size;
+}
+
+// Closes the active segment for good and continues in the next one
+void FileStorage::sealSegment()
+{
+    writeIndexEntry();
+    _indexEntry = {};
+    _activeSegment++;
+    _activeSize = 0;
+    saveManifest();
+}
+
+// Deletes the oldest sealed segment, returns false if there is none
+bool FileStorage::recycleSegment()
+{
+    if (_firstSegment == _activeSegment)
+    {
+        return false;
+    }
+
+    char path[LOG_PATH_LENGTH];
+    segmentPath(path, _firstSegment);
+    size_t size = fileSize(path);
+    uint32_t started = micros();
+    STORAGE.remove(path);
+    _flashStats.record(FLASH_OP_REMOVE, 0, micros() - started);
+    _logSize -= size;
+    _usedBytes -= size + removeIndex(_firstSegment);
+
+    _firstSegment++;
+    saveManifest();
+    return true;
+}
+
+// Deletes a sealed segment, e.g. after it was exported
+bool FileStorage::deleteSegment(uint32_t segment)
+{
+    bool deleted = false;
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+    if (segment == _firstSegment)
+    {
+        deleted = recycleSegment();
+    }
+    else if (segment > _firstSegment && segment < _activeSegment)
+    {
+        char path[LOG_PATH_LENGTH];
+        segmentPath(path, segment);
+        size_t size = fileSize(path);
+        uint32_t started = micros();
+        deleted = STORAGE.remove(path);
+        _flashStats.record(FLASH_OP_REMOVE, 0, micros() - started);
+        if (deleted)
+        {
+            _logSize -= size;
+            _usedBytes -= size + removeIndex(segment);
+        }
+    }
+    // Segments deleted earlier out of order leave gaps behind the first one
+    char path[LOG_PATH_LENGTH];
+    segmentPath(path, _firstSegment);
+    while (_firstSegment < _activeSegment && !STORAGE.exists(path))
+    {
+        _firstSegment++;
+        segmentPath(path, _firstSegment);
+        saveManifest();
+    }
+    xSemaphoreGive(_segmentLock);
+    return deleted;
+}
+
+// Reads from a sealed segment and returns the number of bytes read. size is
+// set to the size of the segment, 0 if it is not sealed or not on flash.
+size_t FileStorage::readSegment(uint32_t segment, uint32_t offset, uint8_t *buffer, size_t length, uint32_t &size)
+{
+    size = 0;
+    size_t read = 0;
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+    char path[LOG_PATH_LENGTH];
+    segmentPath(path, segment);
+    if (segment >= _firstSegment && segment < _activeSegment && STORAGE.exists(path))
+    {
+        fs::File file = STORAGE.open(path);
+        size = file.size();
+        if (offset < size && length > 0 && file.seek(offset))
+        {
+            read = file.read(buffer, length);
+        }
+        file.close();
+    }
+    xSemaphoreGive(_segmentLock);
+    return read;
+}
+
+void FileStorage::loadUploadState()
+{
+    if (!STORAGE.exists(UPLOAD_STATE_FILE))
+    {
+        return;
+    }
+    fs::File file = STORAGE.open(UPLOAD_STATE_FILE);
+    uint32_t state[2];
+    if (file.read((uint8_t *)state, sizeof(state)) == sizeof(state) && state[1] == logCrc32((const uint8_t *)state, sizeof(state[0])))
+    {
+        _uploadedSegment = state[0];
+    }
+    file.close();
+}
+
+// Remembers that all segments before segment reached a collector, written
+// once per uploaded segment
+void FileStorage::setUploadedSegment(uint32_t segment)
+{
+    if (segment == _uploadedSegment)
+    {
+        return;
+    }
+    _uploadedSegment = segment;
+    uint32_t state[2] = {segment, logCrc32((const uint8_t *)&segment, sizeof(segment))};
+    bool existed = STORAGE.exists(UPLOAD_STATE_FILE);
+    uint32_t started = micros();
+    fs::File file = STORAGE.open(UPLOAD_STATE_FILE, FILE_WRITE);
+    size_t size = file ? file.write((const uint8_t *)state, sizeof(state)) : 0;
+    file.close();
+    _flashStats.record(FLASH_OP_MANIFEST, size, micros() - started);
+    if (!existed)
+    {
+        _usedBytes += size;
+    }
+}
+
+void FileStorage::indexPath(char *path, uint32_t segment)
+{
+    snprintf(path, LOG_PATH_LENGTH, LOG_INDEX_FILE, segment);
+}
+
+// Deletes the index of a segment and returns its size
+size_t FileStorage::removeIndex(uint32_t segment)
+{
+    char path[LOG_PATH_LENGTH];
+    indexPath(path, segment);
+    size_t size = fileSize(path);
+    if (size > 0)
+    {
+        uint32_t started = micros();
+        STORAGE.remove(path);
+        _flashStats.record(FLASH_OP_REMOVE, 0, micros() - started);
+    }
+    return size;
+}
+
+// Summarises the records of the active segment written after the last
+// complete block, which have not been indexed before the reset
+void FileStorage::restoreIndex()
+{
+    const size_t records = _activeSize / sizeof(logRecord_t);
+    _indexEntry = {};
+    _indexEntry.block = records / LOG_INDEX_BLOCK;
+    _indexRecords = 0;
+    if (records % LOG_INDEX_BLOCK == 0)
+    {
+        return;
+    }
+
+    char path[LOG_PATH_LENGTH];
+    segmentPath(path, _activeSegment);
+    fs::File file = STORAGE.open(path);
+    file.seek(_indexEntry.block * LOG_INDEX_BLOCK * sizeof(logRecord_t));
+    logRecord_t record;
+    while (file.read((uint8_t *)&record, sizeof(record)) == sizeof(record))
+    {
+        if (logRecordValid(record))
+        {
+            logIndexAdd(_indexEntry, record);
+        }
+        _indexRecords++;
+    }
+    file.close();
+}
+
+// Adds a record written to the active segment to the index
+void FileStorage::indexRecord(const logRecord_t &record)
+{
+    logIndexAdd(_indexEntry, record);
+    if (++_indexRecords == LOG_INDEX_BLOCK)
+    {
+        writeIndexEntry();
+    }
+}
+
+// Appends the summary of the current block to the index of the active segment
+void FileStorage::writeIndexEntry()
+{
+    if (_indexRecords == 0)
+    {
+        return;
+    }
+
+    _indexEntry.crc = logIndexEntryCrc(_indexEntry);
+    char path[LOG_PATH_LENGTH];
+    indexPath(path, _activeSegment);
+    uint32_t started = micros();
+    fs::File file = STORAGE.open(path, FILE_APPEND);
+    if (file && file.write((const uint8_t *)&_indexEntry, sizeof(_indexEntry)) == sizeof(_indexEntry))
+    {
+        _usedBytes += sizeof(_indexEntry);
+    }
+    else
+    {
+        Serial.println(F("Failed to write log index"));
+    }
+    file.close();
+    _flashStats.record(FLASH_OP_INDEX, sizeof(_indexEntry), micros() - started);
+
+    const uint32_t next = _indexEntry.block + 1;
+    _indexEntry = {};
+    _indexEntry.block = next;
+    _indexRecords = 0;
+}
+
+// Reads the next valid entry of an index file
+bool FileStorage::readIndexEntry(fs::File &file, logIndexEntry_t &entry)
+{
+    while (file && file.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry))
+    {
+        if (entry.crc == logIndexEntryCrc(entry))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads block of segment, LOG_INDEX_BLOCK records, under the segment lock and
+// returns the number of records read. With a query, the index entry of the
+// block is looked up first, and a block it rules out is skipped. end is set
+// once the segment is gone or has no more blocks.
+size_t FileStorage::readLogBlock(uint32_t segment, uint32_t block, logRecord_t *records, bool &end, logQueryCursor_t *query)
+{
+    size_t count = 0;
+    char path[LOG_PATH_LENGTH];
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+    segmentPath(path, segment);
+    fs::File file;
+    if (STORAGE.exists(path))
+    {
+        file = STORAGE.open(path);
+    }
+    const uint32_t offset = block * LOG_INDEX_BLOCK * sizeof(logRecord_t);
+    end = !file || offset >= file.size();
+
+    bool skip = false;
+    indexPath(path, segment);
+    if (!end && query != nullptr && STORAGE.exists(path))
+    {
+        // Entries are ordered by block, but a reset may have lost some
+        fs::File index = STORAGE.open(path);
+        index.seek(query->indexPosition);
+        while (!query->hasEntry || query->entry.block < block)
+        {
+            query->hasEntry = readIndexEntry(index, query->entry);
+            if (!query->hasEntry)
+            {
+                break;
+            }
+        }
+        query->indexPosition = index.position();
+        index.close();
+        skip = query->hasEntry && query->entry.block == block && !logIndexMatches(query->entry, query->from, query->to, query->types);
+    }
+
+    if (!end && !skip && file.seek(offset))
+    {
+        count = file.read((uint8_t *)records, LOG_INDEX_BLOCK * sizeof(logRecord_t)) / sizeof(logRecord_t);
+    }
+    file.close();
+    xSemaphoreGive(_segmentLock);
+    return count;
+}
+
+// Calls f for every event of the types in the logTypeBit() mask with a node
+// time within [from, to], followed by its continuation records. Blocks whose
+// index entry rules them out are skipped without reading them. Returns the
+// number of matching events.
+size_t FileStorage::queryLog(uint64_t from, uint64_t to, uint16_t types, const logQueryCallback_t &f)
+{
+    // Include the records still waiting in RAM
+    flush();
+
+    logRecord_t *records = (logRecord_t *)malloc(LOG_INDEX_BLOCK * sizeof(logRecord_t));
+    if (records == nullptr)
+    {
+        Serial.println(F("Not enough memory to query the log"));
+        return 0;
+    }
+
+    // Blocks are read under the segment lock, as the logging task may seal,
+    // recycle or delete segments meanwhile. f runs without it.
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+    const uint32_t first = _firstSegment;
+    const uint32_t active = _activeSegment;
+    xSemaphoreGive(_segmentLock);
+
+    size_t matches = 0;
+    bool stopped = false;
+    for (uint32_t segment = first; segment <= active && !stopped; segment++)
+    {
+        logQueryCursor_t query = {from, to, types, 0, false, {}};
+        size_t pendingNodes = 0;
+        bool end = false;
+        for (uint32_t block = 0; !end && !stopped; block++)
+        {
+            // Continuation records of a matching event are read in any case
+            const size_t count = readLogBlock(segment, block, records, end, pendingNodes == 0 ? &query : nullptr);
+            for (size_t i = 0; i < count && !stopped; i++)
+            {
+                const logRecord_t &record = records[i];
+                if (!logRecordValid(record))
+                {
+                    continue;
+                }
+                if (record.type == LOG_RECORD_CONTINUATION)
+                {
+                    // Node ids of a matching connection event
+                    if (pendingNodes > 0)
+                    {
+                        pendingNodes -= std::min(pendingNodes, (size_t)LOG_NODES_PER_RECORD);
+                        stopped = !f(record);
+                    }
+                    continue;
+                }
+
+                pendingNodes = 0;
+                if ((logTypeBit(record.type) & types) && record.event.time >= from && record.event.time <= to)
+                {
+                    matches++;
+                    if (record.type == BadgeEvent::CONNECTION_EVT)
+                    {
+                        pendingNodes = record.arg;
+                    }
+                    stopped = !f(record);
+                }
+            }
+        }
+    }
+
+    free(records);
+    return matches;
+}
+
+// Prints the events matching a query like printLog()
+void FileStorage::printLog(uint64_t from, uint64_t to, uint16_t types)
+{
+    uint8_t pendingNodes = 0;
+    queryLog(from, to, types, [&pendingNodes](const logRecord_t &record) {
+        printRecord(Serial, record, pendingNodes);
+        return true;
+    });
+}
+
+// Prints the binary log to the Serial as one JSON object per event
+void FileStorage::printLog()
+{
+    // Include the records still waiting in RAM
+    flush();
+
+    logRecord_t *records = (logRecord_t *)malloc(LOG_INDEX_BLOCK * sizeof(logRecord_t));
+    if (records == nullptr)
+    {
+        Serial.println(F("Not enough memory to print the log"));
+        return;
+    }
+
+    // Read under the segment lock block by block, like queryLog()
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+    const uint32_t first = _firstSegment;
+    const uint32_t active = _activeSegment;
+    xSemaphoreGive(_segmentLock);
+
+    uint8_t pendingNodes = 0;
+    size_t corrupted = 0;
+    for (uint32_t segment = first; segment <= active; segment++)
+    {
+        // Segments might have been deleted independently
+        bool end = false;
+        for (uint32_t block = 0; !end; block++)
+        {
+            const size_t count = readLogBlock(segment, block, records, end);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!logRecordValid(records[i]))
+                {
+                    corrupted++;
+                    continue;
+                }
+                printRecord(Serial, records[i], pendingNodes);
+            }
+        }
+    }
+    free(records);
+
+    if (corrupted > 0)
+    {
+        Serial.printf("Skipped %u corrupted records\r\n", corrupted);
+    }
+}
+
+// Streams the log in checksummed frames at LOG_EXPORT_BAUD, starting at offset
+// into the concatenated segments so a broken transfer can be resumed. The
+// offset only means the same data as long as the first segment is the same, so
+// the start frame names it.
+bool FileStorage::exportLog(HardwareSerial &out, uint32_t node, uint32_t offset)
+{
+    // Include the records still waiting in RAM
+    flush();
+
+    uint8_t *block = (uint8_t *)malloc(LOG_EXPORT_BLOCK);
+    if (block == nullptr)
+    {
+        Serial.println(F("Not enough memory to export the log"));
+        return false;
+    }
+
+    // Export what is on flash now, even if the logging task appends meanwhile
+    xSemaphoreTake(_segmentLock, portMAX_DELAY);
+    const uint32_t first = _firstSegment;
+    const uint32_t active = _activeSegment;
+    const uint32_t total = _logSize;
+    xSemaphoreGive(_segmentLock);
+
+    // Tell the receiver to follow to the higher baud rate
+    out.printf("EXPORT %u\r\n", LOG_EXPORT_BAUD);
+    out.flush();
+    const uint32_t baud = out.baudRate();
+    out.updateBaudRate(LOG_EXPORT_BAUD);
+    delay(100);
+
+    logFrameHeader_t header = {};
+    header.node = node;
+    header.offset = offset;
+    header.type = LOG_FRAME_START;
+    const uint32_t start[] = {total, first};
+    header.length = sizeof(start);
+    writeFrame(out, header, (const uint8_t *)start);
+
+    // Read block by block under the segment lock, so segments cannot be
+    // recycled or deleted while they are read. The stream ends at a segment
+    // that is gone, as the offsets after it would no longer match.
+    uint32_t position = 0;
+    char path[LOG_PATH_LENGTH];
+    for (uint32_t segment = first; segment <= active && position < total; segment++)
+    {
+        segmentPath(path, segment);
+        const uint32_t segmentStart = position;
+        uint32_t segmentEnd = segmentStart;
+        bool missing = false;
+        do
+        {
+            size_t read = 0;
+            xSemaphoreTake(_segmentLock, portMAX_DELAY);
+            missing = !STORAGE.exists(path);
+            if (!missing)
+            {
+                fs::File file = STORAGE.open(path);
+                segmentEnd = segmentStart + std::min((uint32_t)file.size(), total - segmentStart);
+                position = std::max(position, std::min(offset, segmentEnd));
+                if (position < segmentEnd && file.seek(position - segmentStart))
+                {
+                    read = file.read(block, std::min((uint32_t)LOG_EXPORT_BLOCK, segmentEnd - position));
+                }
+                file.close();
+            }
+            xSemaphoreGive(_segmentLock);
+
+            if (read == 0)
+            {
+                break;
+            }
+            header.type = LOG_FRAME_DATA;
+            header.offset = position;
+            header.length = read;
+            writeFrame(out, header, block);
+            position += read;
+            yield();
+        } while (position < segmentEnd);
+
+        if (missing)
+        {
+            break;
+        }
+        position = segmentEnd;
+    }
+
+    // Segments deleted meanwhile make the stream shorter than announced
+    header.type = LOG_FRAME_END;
+    header.offset = position;
+    header.length = 0;
+    writeFrame(out, header, nullptr);
+
+    out.flush();
+    out.updateBaudRate(baud);
+    free(block);
+    return true;
+}
+
+void FileStorage::writeFrame(Print &out, logFrameHeader_t &header, const uint8_t *payload)
+{
+    header.sync = LOG_FRAME_SYNC;
+    header.version = LOG_FORMAT_VERSION;
+    uint32_t crc = logCrc32((const uint8_t *)&header, sizeof(header));
+    crc = logCrc32(payload, header.length, crc);
+
+    out.write((const uint8_t *)&header, sizeof(header));
+    out.write(payload, header.length);
+    out.write((const uint8_t *)&crc, sizeof(crc));
+    header.seq++;
+}
+
+// Prints a record with the keys of the former JSON log. Connection events
+// span several records, so the number of node ids still to be printed is
+// carried in pendingNodes.
+void FileStorage::printRecord(Print &out, const logRecord_t &record, uint8_t &pendingNodes)
+{
+    if (record.type == LOG_RECORD_HEADER)
+    {
+        return;
+    }
+
+    if (record.type == LOG_RECORD_CONTINUATION)
+    {
+        for (size_t i = 0; i < LOG_NODES_PER_RECORD && pendingNodes > 0; i++)
+        {
+            pendingNodes--;
+            out.print(record.nodes[i]);
+            out.print(pendingNodes > 0 ? "," : "]}\r\n");
+        }
+        return;
+    }
+
+    // An event interrupts the node list of a truncated connection event
+    if (pendingNodes > 0)
+    {
+        out.print("]}\r\n");
+        pendingNodes = 0;
+    }
+
+    if (record.type == BadgeEvent::ENCOUNTER_EVT)
+    {
+        // Has no wall clock time
+        out.printf("{\"t\":%llu,\"e\":%u,\"n\":%u,\"f\":%u,\"d\":%u,\"c\":%u}\r\n", (unsigned long long)record.encounter.time,
+                   record.type, record.encounter.node, record.encounter.first, record.encounter.duration, record.arg);
+        return;
+    }
+
+    out.printf("{\"t\":%llu,\"s\":%u,\"e\":%u", (unsigned long long)record.event.time, record.event.date, record.type);
+    switch (record.type)
+    {
+    case BadgeEvent::BEAT_EVT:
+        if (record.event.node != 0)
+            out.printf(",\"n\":%u", record.event.node);
+        out.printf(",\"b\":%d}\r\n", record.event.value);
+        break;
+    case BadgeEvent::PICTURE_EVT:
+        out.printf(",\"p\":%d}\r\n", (int8_t)record.arg);
+        break;
+    case BadgeEvent::SHARE_EVT:
+        out.printf(",\"n\":%u,\"p\":%d}\r\n", record.event.node, (int8_t)record.arg);
+        break;
+    case BadgeEvent::NODE_JOIN_EVT:
+    case BadgeEvent::NODE_LEAVE_EVT:
+        out.printf(",\"n\":%u}\r\n", record.event.node);
+        break;
+    case BadgeEvent::CONNECTION_EVT:
+        out.print(",\"n\":[");
+        pendingNodes = record.arg;
+        if (pendingNodes == 0)
+            out.print("]}\r\n");
+        break;
+    default:
+        out.print("}\r\n");
+        break;
+    }
+}
@@ -4,29 +4,50 @@
 #include <ArduinoJson.h>
 #include <SPI.h>
 #include <FS.h>
-#include "SPIFFS.h"
+#include "Storage.h"
 #include <list>
+#include <atomic>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "LogFormat.h"
+#include "LogQueue.h"
+#include "LogSink.h"
+#include "FlashStats.h"
+#include "NodeSet.h"
+#include "EncounterTable.h"
+#include "RosterImport.h"
 
-// JSON file format key specifications
-#define CONFIG_KEY_ID "id"
-#define CONFIG_KEY_GROUP "group"
-#define CONFIG_KEY_COLOR "color"
-#define CONFIG_KEY_PICS "pics"
-
-#define BADGES_MEMORY NUM_BADGES * JSON_ARRAY_SIZE(NUM_PICS) + JSON_ARRAY_SIZE(NUM_BADGES) + NUM_BADGES * JSON_OBJECT_SIZE(4) + NUM_BADGES * 8 + 32
 #define CONFIG_MEMORY JSON_ARRAY_SIZE(NUM_BADGES*NUM_PICS) + JSON_OBJECT_SIZE(3) + 16
-#define LOG_MEMORY 512 //JSON_ARRAY_SIZE(NUM_BADGES *NUM_PICS) + JSON_OBJECT_SIZE(1) + 16
+
+#ifndef LOG_BUFFER_RECORDS
+#define LOG_BUFFER_RECORDS 96 // records collected in RAM before they are written as one batch
+#endif
+#ifndef LOG_FLUSH_AGE
+#define LOG_FLUSH_AGE 30000 // maximum time in ms a record waits in RAM before being written
+#endif
+#ifndef LOG_QUEUE_RECORDS
+#define LOG_QUEUE_RECORDS 128 // records handed over to the logging task, must be a power of two
+#endif
+#define LOG_TASK_CORE 0 // the Arduino loop and with it the mesh run on core 1
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_STACK 4096
+#define LOG_TASK_WAKEUP 1000 // ms between checks for stale records when no events arrive
+#define LOG_FLUSH_TIMEOUT 2000 // ms to wait for the logging task to complete a requested flush
+#define LOG_PATH_LENGTH 24
+#define LOG_MAX_SINKS 4 // sinks the log records are passed to, including the log file
+#define LOG_DELTA_CHUNK 8 // join, leave and encounter records handed over at once, bounds the stack used for logging
+
+// Events are never split, so the largest connection event has to fit
+static_assert(LOG_BUFFER_RECORDS >= 1 + (LOG_MAX_NODES + LOG_NODES_PER_RECORD - 1) / LOG_NODES_PER_RECORD, "LOG_BUFFER_RECORDS too small");
+static_assert(LOG_QUEUE_RECORDS >= 1 + (LOG_MAX_NODES + LOG_NODES_PER_RECORD - 1) / LOG_NODES_PER_RECORD, "LOG_QUEUE_RECORDS too small");
 
 template <typename T>
 using SimpleList = std::list<T>;
 
-struct badges_t
-{
-    uint32_t node;
-    uint8_t group;
-    uint32_t color;
-    uint8_t pics[NUM_PICS];
-};
+// Receives the records of a log query, returns false to end the query
+typedef std::function<bool(const logRecord_t &record)> logQueryCallback_t;
 
 struct badgeConfig_t
 {
@@ -36,34 +57,177 @@ struct badgeConfig_t
     uint8_t pics[NUM_BADGES * NUM_PICS];
 };
 
-struct BadgeEvent
+// Parsed configuration as persisted on flash, so booting needs no JSON parsing.
+// Snapshots are written alternately to CONFIG_SLOTS files, so the previous one
+// survives a reset in the middle of a save. The newest valid slot wins.
+#define CONFIG_SNAPSHOT_MAGIC 0x43474744 // "DGGC" in little endian
+#define CONFIG_SNAPSHOT_VERSION 2 // increase whenever badgeConfig_t changes
+#define CONFIG_SLOTS 2
+struct __attribute__((packed)) configSnapshot_t
 {
-    time_t time;
-    enum EventType
-    {
-        CONNECTION_EVT,
-        SHARE_EVT,
-        BEAT_EVT,
-        POWER_EVT,
-        PICTURE_EVT
-    } type;
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size; // sizeof(badgeConfig_t)
+    uint32_t generation; // incremented with every save
+    badgeConfig_t config;
+    uint32_t crc; // CRC-32 of the preceding fields
+};
+
+class FileStorage;
+
+// Collects the records in RAM and writes them to the log segments in batches
+class LogFileSink : public LogSink
+{
+public:
+    LogFileSink(FileStorage &storage, logLevel_t level) : LogSink(level), _storage(storage) {}
+
+    void write(const logRecord_t &record) override;
+    void flush() override;
+
+private:
+    FileStorage &_storage;
 };
 
 class FileStorage
 {
+    friend class LogFileSink;
+
 public:
-    FileStorage(){}
+    FileStorage() { _sinks[0] = &_fileSink; }
     ~FileStorage(){}
     
+    bool begin();
     void printFile(const char *filename);
+    void printLog();
+    void printLog(uint64_t from, uint64_t to, uint16_t types);
+    size_t queryLog(uint64_t from, uint64_t to, uint16_t types, const logQueryCallback_t &f);
+    bool exportLog(HardwareSerial &out, uint32_t node, uint32_t offset = 0);
     bool initConfiguration(badgeConfig_t &config, uint32_t nodeid);
     bool loadConfiguration(badgeConfig_t &config);
     void saveConfiguration(const badgeConfig_t &config);
-    void logBootEvent(const uint32_t time);
-    void logBeatEvent(const uint32_t time,const int32_t &beat, const uint32_t &node);
-    void logPictureEvent(const uint32_t time, const int8_t &pic);
-    void logSharingEvent(const uint32_t time, const uint32_t &node, const int8_t &pic);
-    void logConnectionEvent(const uint32_t time, const SimpleList<uint32_t> &nodes);
-    void logEvent(const StaticJsonDocument<LOG_MEMORY> &doc);
+    void exportConfiguration(Print &out, const badgeConfig_t &config);
+    void log(const BadgeEvent &event);
+    void logConnectionEvent(const uint64_t time, const NodeSet &nodes);
+    void logEncounters(const uint64_t time, EncounterTable &table);
+    bool logEvent(const logRecord_t *records, size_t count);
+    void flush();
+    bool addSink(LogSink &sink);
+    void removeSink(LogSink &sink);
+    LogSink &fileSink() { return _fileSink; }
+    FlashStats &flashStats() { return _flashStats; }
+    size_t droppedRecords() const { return _droppedRecords; }
+    size_t usedBytes() const { return _usedBytes; }
+    size_t totalBytes() const { return _totalBytes; }
+    // Keeps the usage current for files written by others, e.g. the picture cache
+    void fileReplaced(size_t oldSize, size_t newSize) { _usedBytes += newSize; _usedBytes -= oldSize; }
+    size_t logSize() const { return _logSize; }
+    uint32_t firstSegment() const { return _firstSegment; }
+    uint32_t activeSegment() const { return _activeSegment; }
+    static void segmentPath(char *path, uint32_t segment);
+    static void indexPath(char *path, uint32_t segment);
+    static void printRecord(Print &out, const logRecord_t &record, uint8_t &pendingNodes);
+    bool deleteSegment(uint32_t segment);
+    size_t readSegment(uint32_t segment, uint32_t offset, uint8_t *buffer, size_t length, uint32_t &size);
+    uint32_t uploadedSegment() const { return _uploadedSegment; }
+    void setUploadedSegment(uint32_t segment);
+
+private:
+    // Last logged connection snapshot, owned by the application
+    NodeSet _connectedNodes;
+    size_t _changesSinceKeyframe = LOG_KEYFRAME_INTERVAL; // the first snapshot is a keyframe
+
+    // Owned by the logging task once it is started
+    uint8_t _deliverTo = 0; // bit per sink receiving the event being drained
+    logRecord_t _logBuffer[LOG_BUFFER_RECORDS];
+    size_t _bufferedRecords = 0;
+    uint32_t _oldestBufferedAt = 0;
+    NodeSet _replayNodes; // snapshot replayed from the written records
+    bool _replayValid = false;
+    uint64_t _replayTime = 0;
+    uint32_t _replayDate = 0;
+    logIndexEntry_t _indexEntry = {}; // summary of the block being filled
+    size_t _indexRecords = 0;
+
+    // Shared between the application and the logging task
+    LogQueue<logRecord_t, LOG_QUEUE_RECORDS> _logQueue;
+    TaskHandle_t _logTask = nullptr;
+    SemaphoreHandle_t _flushed = nullptr;
+    // Flushes are numbered, so a completion that arrives after its flush()
+    // timed out is not taken for the completion of the next one
+    std::atomic<uint32_t> _flushRequests{0};
+    std::atomic<uint32_t> _flushesDone{0};
+    std::atomic<size_t> _droppedRecords{0};
+    LogFileSink _fileSink{*this, LOG_FILE_LEVEL};
+    std::atomic<LogSink *> _sinks[LOG_MAX_SINKS] = {};
+
+    // Filesystem usage computed at mount and updated with every write, because
+    // usedBytes() of the filesystem walks its metadata. Counts file contents
+    // only, so it slightly underestimates the pages in use.
+    std::atomic<size_t> _usedBytes{0};
+    std::atomic<size_t> _logSize{0};
+    size_t _configSize[CONFIG_SLOTS] = {};
+    size_t _totalBytes = 0;
+    FlashStats _flashStats;
+    size_t _flashStatsSize = 0;
+    uint32_t _flashStatsSavedAt = 0;
+
+    // Log segments, guarded by _segmentLock as sealed segments may be
+    // deleted from the application while the logging task writes
+    SemaphoreHandle_t _segmentLock = nullptr;
+    std::atomic<uint32_t> _firstSegment{0};
+    std::atomic<uint32_t> _activeSegment{0};
+    size_t _activeSize = 0;
+
+    // Segments before this one were uploaded to a collector, see LogUploader.h
+    uint32_t _uploadedSegment = 0;
+
+    // Slot holding the newest configuration snapshot, the next save goes to the other
+    uint8_t _configSlot = CONFIG_SLOTS - 1;
+    uint32_t _configGeneration = 0;
+
+    bool importRoster(badgeConfig_t &config, uint32_t nodeid);
+    bool loadSnapshot(badgeConfig_t &config);
+    bool readSnapshot(uint8_t slot, configSnapshot_t &snapshot);
+    static void configSlotPath(char *path, uint8_t slot);
+    bool importConfiguration(badgeConfig_t &config);
+    void loadUploadState();
+    void loadFlashStats();
+    void saveFlashStats();
+    void loadManifest();
+    void saveManifest();
+    void sealSegment();
+    bool recycleSegment();
+    size_t removeIndex(uint32_t segment);
+    void restoreIndex();
+    void indexRecord(const logRecord_t &record);
+    void writeIndexEntry();
+    static bool readIndexEntry(fs::File &file, logIndexEntry_t &entry);
+    // A query of queryLog() and how far it got in the index of a segment
+    struct logQueryCursor_t
+    {
+        uint64_t from;
+        uint64_t to;
+        uint16_t types;
+        uint32_t indexPosition; // of the next entry in the index file
+        bool hasEntry;          // entry is the first one not before the current block
+        logIndexEntry_t entry;
+    };
+    size_t readLogBlock(uint32_t segment, uint32_t block, logRecord_t *records, bool &end, logQueryCursor_t *query = nullptr);
+
+    template <typename F>
+    bool logRecords(size_t count, F fill);
+    void startLogTask();
+    static void logTask(void *param);
+    void processLog();
+    void drainQueue();
+    void flushSinks();
+    void bufferRecord(const logRecord_t &record);
+    void flushBuffer();
+    void writeRecords(const logRecord_t *records, size_t count);
+    size_t keyframeLength() const;
+    size_t writeKeyframe(fs::File &file);
+    void replayConnections(const logRecord_t *records, size_t count);
+    static void connectionRecord(logRecord_t &record, size_t index, uint64_t time, uint32_t date, const NodeSet &nodes);
+    static void writeFrame(Print &out, logFrameHeader_t &header, const uint8_t *payload);
 };
 
@@ -0,0 +1,148 @@
+#include "FlashStats.h"
+#if CONFIG_SPI_FLASH_ENABLE_COUNTERS
+#include <esp_spi_flash.h>
+#endif
+
+FlashStats::FlashStats()
+{
+    begin(nullptr);
+}
+
+// Continues the totals saved before the reset, if any
+void FlashStats::begin(const flashStats_t *saved)
+{
+    portENTER_CRITICAL(&_lock);
+    if (saved != nullptr && valid(*saved))
+    {
+        _stats = *saved;
+    }
+    else
+    {
+        _stats = {};
+        _stats.magic = FLASH_STATS_MAGIC;
+        _stats.version = FLASH_STATS_VERSION;
+        _stats.size = sizeof(flashStats_t);
+    }
+    _stats.boots++;
+    portEXIT_CRITICAL(&_lock);
+}
+
+// Adds a write of requested bytes, or a deletion, that took us
+void FlashStats::record(flashOp_t op, size_t requested, uint32_t us)
+{
+    portENTER_CRITICAL(&_lock);
+    _stats.requestedBytes += requested;
+    _stats.operations[op]++;
+    _stats.latency[op][bucket(us)]++;
+    // Saving the statistics alone does not make them worth saving again
+    _unsaved |= op != FLASH_OP_STATS;
+#if !CONFIG_SPI_FLASH_ENABLE_COUNTERS
+    if (op != FLASH_OP_REMOVE)
+    {
+        size_t pages = (requested + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE + FLASH_WRITE_OVERHEAD;
+        _stats.writtenBytes += pages * FLASH_PAGE_SIZE;
+        _stats.erases = _stats.writtenBytes / FLASH_SECTOR_SIZE;
+    }
+#endif
+    portEXIT_CRITICAL(&_lock);
+}
+
+flashStats_t FlashStats::snapshot()
+{
+    update();
+    portENTER_CRITICAL(&_lock);
+    flashStats_t stats = _stats;
+    portEXIT_CRITICAL(&_lock);
+    stats.crc = logCrc32((const uint8_t *)&stats, offsetof(flashStats_t, crc));
+    return stats;
+}
+
+// Takes a snapshot to save, returns false if nothing was recorded since the
+// last one
+bool FlashStats::unsavedSnapshot(flashStats_t &stats)
+{
+    portENTER_CRITICAL(&_lock);
+    const bool unsaved = _unsaved;
+    _unsaved = false;
+    portEXIT_CRITICAL(&_lock);
+    if (unsaved)
+    {
+        stats = snapshot();
+    }
+    return unsaved;
+}
+
+// Adds what the flash driver counted since the last update
+void FlashStats::update()
+{
+#if CONFIG_SPI_FLASH_ENABLE_COUNTERS
+    const spi_flash_counters_t *counters = spi_flash_get_counters();
+    portENTER_CRITICAL(&_lock);
+    _stats.writtenBytes += counters->write.bytes - _countedWrite;
+    _stats.erases += (counters->erase.bytes - _countedErase) / FLASH_SECTOR_SIZE;
+    _countedWrite = counters->write.bytes;
+    _countedErase = counters->erase.bytes;
+    portEXIT_CRITICAL(&_lock);
+#endif
+}
+
+void FlashStats::print(Print &out, size_t totalBytes)
+{
+    static const char *names[FLASH_OPS] = {"log", "index", "manifest", "config", "remove", "stats"};
+
+    flashStats_t stats = snapshot();
+    out.printf("Flash %s over %u boots: %llu bytes requested, %llu written, %llu sectors erased\r\n",
+#if CONFIG_SPI_FLASH_ENABLE_COUNTERS
+               "measured",
+#else
+               "estimated",
+#endif
+               stats.boots, (unsigned long long)stats.requestedBytes, (unsigned long long)stats.writtenBytes,
+               (unsigned long long)stats.erases);
+    if (stats.requestedBytes > 0)
+    {
+        out.printf("Write amplification: %.2f\r\n", (double)stats.writtenBytes / stats.requestedBytes);
+    }
+
+    // Assumes the filesystem levels the wear over all of its sectors
+    const size_t sectors = totalBytes / FLASH_SECTOR_SIZE;
+    if (sectors > 0)
+    {
+        out.printf("Wear: %.4f %% of %u erase cycles\r\n", 100.0 * stats.erases / ((double)sectors * FLASH_ERASE_CYCLES), FLASH_ERASE_CYCLES);
+    }
+
+    out.print("Latency (ms)  <1");
+    for (uint8_t b = 1; b < FLASH_STATS_BUCKETS; b++)
+    {
+        out.printf(" %s%u", b == FLASH_STATS_BUCKETS - 1 ? ">=" : "<", 1 << (b - (b == FLASH_STATS_BUCKETS - 1)));
+    }
+    out.print("\r\n");
+    for (uint8_t op = 0; op < FLASH_OPS; op++)
+    {
+        out.printf("%-9s %5u:", names[op], stats.operations[op]);
+        for (uint8_t b = 0; b < FLASH_STATS_BUCKETS; b++)
+        {
+            out.printf(" %u", stats.latency[op][b]);
+        }
+        out.print("\r\n");
+    }
+}
+
+bool FlashStats::valid(const flashStats_t &stats)
+{
+    return stats.magic == FLASH_STATS_MAGIC && stats.version == FLASH_STATS_VERSION && stats.size == sizeof(flashStats_t) &&
+           stats.crc == logCrc32((const uint8_t *)&stats, offsetof(flashStats_t, crc));
+}
+
+// Histogram bucket of a duration: 0 below 1 ms, then b for [2^(b-1), 2^b) ms
+uint8_t FlashStats::bucket(uint32_t us)
+{
+    uint32_t ms = us / 1000;
+    uint8_t b = 0;
+    while (ms > 0 && b < FLASH_STATS_BUCKETS - 1)
+    {
+        ms >>= 1;
+        b++;
+    }
+    return b;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Arduino.h"
+#include <freertos/FreeRTOS.h>
+#include "LogFormat.h"
+
+#define FLASH_STATS_MAGIC 0x53464744 // "DGFS" in little endian
+#define FLASH_STATS_VERSION 1
+#define FLASH_STATS_BUCKETS 12 // latency histogram: < 1 ms, then powers of two up to >= 1024 ms
+#define FLASH_PAGE_SIZE 256    // smallest unit the filesystems program
+#define FLASH_SECTOR_SIZE 4096 // smallest unit the flash erases
+#define FLASH_WRITE_OVERHEAD 2 // metadata pages estimated per write, e.g. object index and size
+#define FLASH_ERASE_CYCLES 100000 // rated erase cycles per sector
+
+// Filesystem operations of FileStorage that are measured separately
+enum flashOp_t : uint8_t
+{
+    FLASH_OP_LOG,      // append of a batch to the active segment
+    FLASH_OP_INDEX,    // append of an entry to a segment index
+    FLASH_OP_MANIFEST, // rewrite of the log manifest or the upload progress
+    FLASH_OP_CONFIG,   // configuration snapshot
+    FLASH_OP_REMOVE,   // deletion of a segment or index
+    FLASH_OP_STATS,    // save of these statistics
+    FLASH_OPS
+};
+
+// Totals since the statistics were first saved, persisted in FLASH_STATS_FILE
+struct __attribute__((packed)) flashStats_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size; // sizeof(flashStats_t)
+    uint32_t boots;
+    uint64_t requestedBytes; // handed to the filesystem
+    uint64_t writtenBytes;   // programmed into the flash
+    uint64_t erases;         // sectors erased
+    uint32_t operations[FLASH_OPS];
+    uint32_t latency[FLASH_OPS][FLASH_STATS_BUCKETS]; // operations per duration bucket
+    uint32_t crc;            // CRC-32 of the preceding fields
+};
+
+// Counts what the filesystem writes on behalf of the badge. With
+// CONFIG_SPI_FLASH_ENABLE_COUNTERS set in the sdkconfig, the programmed bytes
+// and erased sectors are read from the flash driver. The prebuilt Arduino
+// core leaves the counters off, so they are estimated instead: every write
+// programs its data and FLASH_WRITE_OVERHEAD pages of metadata, and every
+// programmed sector has to be erased once before it can be used again.
+// Deletions are counted, but not estimated to program anything.
+// Called from the logging task and the loop, so updates are guarded.
+class FlashStats
+{
+public:
+    FlashStats();
+
+    void begin(const flashStats_t *saved);
+    void record(flashOp_t op, size_t requested, uint32_t us);
+    flashStats_t snapshot();
+    bool unsavedSnapshot(flashStats_t &stats);
+    void print(Print &out, size_t totalBytes);
+
+    static bool valid(const flashStats_t &stats);
+    static uint8_t bucket(uint32_t us);
+
+private:
+    flashStats_t _stats;
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    bool _unsaved = false; // operations recorded since the last unsavedSnapshot()
+#if CONFIG_SPI_FLASH_ENABLE_COUNTERS
+    uint32_t _countedWrite = 0;
+    uint32_t _countedErase = 0;
+#endif
+
+    void update();
+};
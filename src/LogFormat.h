@@ -0,0 +1,379 @@
+#pragma once
+
+// Binary format of the interaction log.
+// This header is shared with the host tools in tools/, so it must only depend
+// on the C standard library and never on the Arduino core.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define LOG_MAGIC 0x4b4d4744 // "DGMK" in little endian
+#define LOG_MANIFEST_MAGIC 0x464d4744 // "DGMF" in little endian
+#define LOG_FRAME_SYNC 0x5aa5
+#define LOG_FORMAT_VERSION 2
+#define LOG_NODES_PER_RECORD 5 // node ids carried by one continuation record
+#define LOG_MAX_NODES UINT8_MAX // node ids in one connection event
+
+// Event handed to the log: the type tags which member of the union holds the
+// payload. Events are plain values built on the stack by the factories below
+// and turned into records by logEncodeEvent(), so logging an event needs no
+// heap and no intermediate document. sizeof(BadgeEvent) is 32 bytes.
+struct BadgeEvent
+{
+    enum EventType
+    {
+        CONNECTION_EVT,
+        SHARE_EVT,
+        BEAT_EVT,
+        POWER_EVT,
+        PICTURE_EVT,
+        NODE_JOIN_EVT, // a node was added to the last connection snapshot
+        NODE_LEAVE_EVT, // a node was removed from the last connection snapshot
+        ENCOUNTER_EVT   // checkpoint of the co-presence with one peer
+    } type;
+    uint64_t time; // mesh node time in us extended to 64 bits
+    union
+    {
+        struct
+        {
+            int32_t length; // ms
+            uint32_t node;  // badge the beat came from
+        } beat;
+        int8_t picture; // PICTURE_EVT
+        struct
+        {
+            uint32_t node;
+            int8_t picture;
+        } share;
+        uint32_t node;    // NODE_JOIN_EVT and NODE_LEAVE_EVT
+        uint8_t numNodes; // CONNECTION_EVT, the nodes follow in continuation records
+        struct
+        {
+            uint32_t node;
+            uint16_t count;     // separate encounters
+            uint32_t first;     // first seen, node time in s
+            uint32_t duration;  // co-presence since boot in s
+        } encounter;
+    };
+
+    static BadgeEvent power(uint64_t time)
+    {
+        return make(POWER_EVT, time);
+    }
+
+    static BadgeEvent beatChanged(uint64_t time, int32_t length, uint32_t node)
+    {
+        BadgeEvent event = make(BEAT_EVT, time);
+        event.beat.length = length;
+        event.beat.node = node;
+        return event;
+    }
+
+    static BadgeEvent pictureShown(uint64_t time, int8_t picture)
+    {
+        BadgeEvent event = make(PICTURE_EVT, time);
+        event.picture = picture;
+        return event;
+    }
+
+    static BadgeEvent shared(uint64_t time, uint32_t node, int8_t picture)
+    {
+        BadgeEvent event = make(SHARE_EVT, time);
+        event.share.node = node;
+        event.share.picture = picture;
+        return event;
+    }
+
+    static BadgeEvent nodeChanged(uint64_t time, uint32_t node, bool joined)
+    {
+        BadgeEvent event = make(joined ? NODE_JOIN_EVT : NODE_LEAVE_EVT, time);
+        event.node = node;
+        return event;
+    }
+
+    static BadgeEvent connection(uint64_t time, uint8_t numNodes)
+    {
+        BadgeEvent event = make(CONNECTION_EVT, time);
+        event.numNodes = numNodes;
+        return event;
+    }
+
+    // Times in us, lastSeen becomes the time of the event
+    static BadgeEvent encountered(uint64_t lastSeen, uint32_t node, uint16_t count, uint64_t firstSeen, uint64_t duration)
+    {
+        BadgeEvent event = make(ENCOUNTER_EVT, lastSeen);
+        event.encounter.node = node;
+        event.encounter.count = count;
+        event.encounter.first = firstSeen / 1000000;
+        event.encounter.duration = duration / 1000000;
+        return event;
+    }
+
+private:
+    static BadgeEvent make(EventType type, uint64_t time)
+    {
+        BadgeEvent event = {};
+        event.type = type;
+        event.time = time;
+        return event;
+    }
+};
+
+static_assert(sizeof(BadgeEvent) == 32, "BadgeEvent is passed on the stack, keep it small");
+
+// Record types that are not events but structure the log
+enum logRecordType_t : uint8_t
+{
+    LOG_RECORD_HEADER = 0xf0,      // first record of every log segment
+    LOG_RECORD_CONTINUATION = 0xf1 // carries additional node ids of the preceding event
+};
+
+// Every entry of the log has the same size, so a record can be located and
+// verified without parsing its predecessors. An event with a node list (e.g. a
+// connection event with `arg` nodes) is followed by ceil(arg / 5)
+// continuation records.
+//
+// Connection events are full snapshots of the connected nodes (keyframes),
+// written periodically and at the start of every segment. In between, only
+// NODE_JOIN_EVT and NODE_LEAVE_EVT records change the last snapshot.
+//
+// ENCOUNTER_EVT records summarise the co-presence with one peer since boot.
+// They are written periodically, the last one of a peer supersedes the others.
+struct __attribute__((packed)) logRecord_t
+{
+    uint8_t type; // BadgeEvent::EventType or logRecordType_t
+    uint8_t arg;  // picture id, number of nodes in the following continuation records or number of encounters
+    uint16_t crc; // CRC-16/CCITT of the record, computed while crc is 0
+    union
+    {
+        struct __attribute__((packed))
+        {
+            uint64_t time; // mesh node time in us extended to 64 bits ("t")
+            uint32_t date; // wall clock time in s ("s")
+            uint32_t node; // node involved in the event ("n")
+            int32_t value; // beat length in ms ("b")
+        } event;
+        struct __attribute__((packed))
+        {
+            uint64_t time;     // last seen, node time in us ("t")
+            uint32_t first;    // first seen, node time in s ("f")
+            uint32_t node;     // peer ("n")
+            uint32_t duration; // co-presence since boot in s ("d"), encounters in arg ("c")
+        } encounter;
+        struct
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t recordSize;
+            uint32_t segment; // number of the segment this header starts
+            uint32_t reserved;
+        } header;
+        uint32_t nodes[LOG_NODES_PER_RECORD];
+    };
+};
+
+static_assert(sizeof(logRecord_t) == 24, "log records must stay 24 bytes");
+
+inline uint16_t logCrc16(const uint8_t *data, size_t len, uint16_t crc = 0xffff)
+{
+    while (len--)
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+inline uint16_t logRecordCrc(const logRecord_t &record)
+{
+    logRecord_t copy = record;
+    copy.crc = 0;
+    return logCrc16((const uint8_t *)&copy, sizeof(copy));
+}
+
+inline void logRecordSeal(logRecord_t &record)
+{
+    record.crc = logRecordCrc(record);
+}
+
+inline bool logRecordValid(const logRecord_t &record)
+{
+    return record.crc == logRecordCrc(record);
+}
+
+// Encodes an event as its first record, without the CRC. date is the wall
+// clock time in s, which encounter records do not carry.
+inline logRecord_t logEncodeEvent(const BadgeEvent &event, uint32_t date)
+{
+    logRecord_t record = {};
+    record.type = event.type;
+    if (event.type == BadgeEvent::ENCOUNTER_EVT)
+    {
+        record.arg = event.encounter.count < UINT8_MAX ? event.encounter.count : UINT8_MAX;
+        record.encounter.time = event.time;
+        record.encounter.first = event.encounter.first;
+        record.encounter.node = event.encounter.node;
+        record.encounter.duration = event.encounter.duration;
+        return record;
+    }
+
+    record.event.time = event.time;
+    record.event.date = date;
+    switch (event.type)
+    {
+    case BadgeEvent::BEAT_EVT:
+        record.event.node = event.beat.node;
+        record.event.value = event.beat.length;
+        break;
+    case BadgeEvent::PICTURE_EVT:
+        record.arg = event.picture;
+        break;
+    case BadgeEvent::SHARE_EVT:
+        record.arg = event.share.picture;
+        record.event.node = event.share.node;
+        break;
+    case BadgeEvent::NODE_JOIN_EVT:
+    case BadgeEvent::NODE_LEAVE_EVT:
+        record.event.node = event.node;
+        break;
+    case BadgeEvent::CONNECTION_EVT:
+        record.arg = event.numNodes;
+        break;
+    default:
+        break;
+    }
+    return record;
+}
+
+// Number of records of a connection event listing numNodes nodes
+inline size_t logConnectionRecords(size_t numNodes)
+{
+    return 1 + (numNodes + LOG_NODES_PER_RECORD - 1) / LOG_NODES_PER_RECORD;
+}
+
+// Number of records of the event starting with record
+inline size_t logEventRecords(const logRecord_t &record)
+{
+    return record.type == BadgeEvent::CONNECTION_EVT ? logConnectionRecords(record.arg) : 1;
+}
+
+inline logRecord_t logHeaderRecord(uint32_t segment)
+{
+    logRecord_t record = {};
+    record.type = LOG_RECORD_HEADER;
+    record.header.magic = LOG_MAGIC;
+    record.header.version = LOG_FORMAT_VERSION;
+    record.header.recordSize = sizeof(logRecord_t);
+    record.header.segment = segment;
+    logRecordSeal(record);
+    return record;
+}
+
+// The log is split into numbered segment files of bounded size. The manifest
+// names the range of segments on flash; all segments before the active one are
+// sealed and never written again.
+struct __attribute__((packed)) logManifest_t
+{
+    uint32_t magic;
+    uint32_t first;  // oldest segment still on flash
+    uint32_t active; // segment currently appended to
+    uint16_t version;
+    uint16_t crc; // CRC-16/CCITT of the preceding fields
+};
+
+inline uint16_t logManifestCrc(const logManifest_t &manifest)
+{
+    return logCrc16((const uint8_t *)&manifest, offsetof(logManifest_t, crc));
+}
+
+inline uint32_t logCrc32(const uint8_t *data, size_t len, uint32_t crc = 0)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Sparse index of a segment, stored next to it in a file of the same number.
+// Every LOG_INDEX_BLOCK records of the segment form a block, summarised by one
+// entry once the block is complete or the segment is sealed. Blocks without an
+// entry, e.g. the one being filled, are scanned by queries.
+#define LOG_INDEX_BLOCK 128
+#define LOG_ALL_TYPES 0xffff
+
+// Bit of an event type in the type masks of queries and index entries
+inline uint16_t logTypeBit(uint8_t type)
+{
+    return type < 16 ? 1 << type : 0;
+}
+
+struct __attribute__((packed)) logIndexEntry_t
+{
+    uint32_t block;   // number of the block within the segment
+    uint64_t minTime; // range of the node times of the events in the block
+    uint64_t maxTime;
+    uint16_t types; // logTypeBit() of every event type in the block
+    uint16_t crc;   // CRC-16/CCITT of the preceding fields
+};
+
+inline uint16_t logIndexEntryCrc(const logIndexEntry_t &entry)
+{
+    return logCrc16((const uint8_t *)&entry, offsetof(logIndexEntry_t, crc));
+}
+
+// Adds an event record to the summary of its block
+inline void logIndexAdd(logIndexEntry_t &entry, const logRecord_t &record)
+{
+    uint16_t bit = logTypeBit(record.type);
+    if (bit == 0)
+    {
+        return; // headers and continuation records carry no time
+    }
+    if (entry.types == 0 || record.event.time < entry.minTime)
+        entry.minTime = record.event.time;
+    if (entry.types == 0 || record.event.time > entry.maxTime)
+        entry.maxTime = record.event.time;
+    entry.types |= bit;
+}
+
+inline bool logIndexMatches(const logIndexEntry_t &entry, uint64_t from, uint64_t to, uint16_t types)
+{
+    return (entry.types & types) != 0 && entry.minTime <= to && entry.maxTime >= from;
+}
+
+// Bulk export of the log over the serial port. The exported stream is the
+// concatenation of all segments on flash. It is sent as frames of a header,
+// `length` bytes of payload and the CRC-32 of both, so a receiver can detect
+// broken frames and resume the transfer at the last good offset. Offsets are
+// only valid for the same first segment; once it was recycled or deleted, the
+// transfer has to start over.
+// A collector node forwards the sealed segments uploaded by the badges over
+// the mesh in LOG_FRAME_SEGMENT frames, where node is the uploading badge.
+enum logFrameType_t : uint8_t
+{
+    LOG_FRAME_START = 1, // payload: uint32_t total length of the exported stream, uint32_t its first segment
+    LOG_FRAME_DATA = 2,  // payload: log data starting at offset
+    LOG_FRAME_END = 3,   // no payload, offset is the end of the stream
+    LOG_FRAME_SEGMENT = 4 // payload: uint32_t segment number, then data of that segment starting at offset
+};
+
+struct __attribute__((packed)) logFrameHeader_t
+{
+    uint16_t sync; // LOG_FRAME_SYNC
+    uint8_t type;  // logFrameType_t
+    uint8_t version;
+    uint32_t node;   // badge the log belongs to
+    uint32_t seq;    // frame number within the transfer
+    uint32_t offset; // position of the payload in the exported stream
+    uint16_t length; // bytes of payload following the header
+};
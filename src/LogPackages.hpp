@@ -0,0 +1,117 @@
+#pragma once
+
+// Mesh packages carrying the interaction log, numbered after the packages of
+// BadgeProtocol.hpp
+
+#include <painlessMesh.h>
+
+#define LOG_UPLINK_PKG 40
+
+// Records of the log broadcast as they are logged (see the uplink sink in
+// BondingInteraction.ino). seq counts the records the badge sent before, so a
+// receiver can tell when packages were lost.
+class LogUplinkPackage : public painlessmesh::plugin::BroadcastPackage
+{
+public:
+    uint32_t seq = 0;
+    String records; // base64 encoded logRecord_t
+
+    LogUplinkPackage() : BroadcastPackage(LOG_UPLINK_PKG) {}
+
+    LogUplinkPackage(JsonObject jsonObj) : BroadcastPackage(jsonObj)
+    {
+        seq = jsonObj["seq"];
+        records = jsonObj["records"].as<String>();
+    }
+
+    JsonObject addTo(JsonObject &&jsonObj) const
+    {
+        jsonObj = BroadcastPackage::addTo(std::move(jsonObj));
+        jsonObj["seq"] = seq;
+        jsonObj["records"] = records;
+        return jsonObj;
+    }
+
+    size_t jsonObjectSize() const
+    {
+        return JSON_OBJECT_SIZE(noJsonFields + 2) + records.length() + 1;
+    }
+};
+
+#define LOG_BEACON_PKG 41
+#define LOG_CHUNK_PKG 42
+#define LOG_ACK_PKG 43
+
+// Broadcast by the collector node, badges upload their sealed segments to the
+// collector they heard last (see LogUploader.h)
+class LogBeaconPackage : public painlessmesh::plugin::BroadcastPackage
+{
+public:
+    LogBeaconPackage() : BroadcastPackage(LOG_BEACON_PKG) {}
+    LogBeaconPackage(JsonObject jsonObj) : BroadcastPackage(jsonObj) {}
+};
+
+// Part of a sealed segment sent to the collector
+class LogChunkPackage : public painlessmesh::plugin::SinglePackage
+{
+public:
+    uint32_t segment = 0;
+    uint32_t offset = 0; // position of the data in the segment
+    uint32_t size = 0;   // of the whole segment
+    String data;         // base64 encoded
+
+    LogChunkPackage() : SinglePackage(LOG_CHUNK_PKG) {}
+
+    LogChunkPackage(JsonObject jsonObj) : SinglePackage(jsonObj)
+    {
+        segment = jsonObj["segment"];
+        offset = jsonObj["offset"];
+        size = jsonObj["size"];
+        data = jsonObj["data"].as<String>();
+    }
+
+    JsonObject addTo(JsonObject &&jsonObj) const
+    {
+        jsonObj = SinglePackage::addTo(std::move(jsonObj));
+        jsonObj["segment"] = segment;
+        jsonObj["offset"] = offset;
+        jsonObj["size"] = size;
+        jsonObj["data"] = data;
+        return jsonObj;
+    }
+
+    size_t jsonObjectSize() const
+    {
+        return JSON_OBJECT_SIZE(noJsonFields + 4) + data.length() + 1;
+    }
+};
+
+// Answer of the collector to a chunk: the offset in the segment it expects
+// next. Equal to the size of the segment once it is complete.
+class LogAckPackage : public painlessmesh::plugin::SinglePackage
+{
+public:
+    uint32_t segment = 0;
+    uint32_t offset = 0;
+
+    LogAckPackage() : SinglePackage(LOG_ACK_PKG) {}
+
+    LogAckPackage(JsonObject jsonObj) : SinglePackage(jsonObj)
+    {
+        segment = jsonObj["segment"];
+        offset = jsonObj["offset"];
+    }
+
+    JsonObject addTo(JsonObject &&jsonObj) const
+    {
+        jsonObj = SinglePackage::addTo(std::move(jsonObj));
+        jsonObj["segment"] = segment;
+        jsonObj["offset"] = offset;
+        return jsonObj;
+    }
+
+    size_t jsonObjectSize() const
+    {
+        return JSON_OBJECT_SIZE(noJsonFields + 2);
+    }
+};
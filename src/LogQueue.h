@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded lock-free queue for handing log records from the application to the
+// logging task. It is safe for exactly one producer and one consumer running
+// concurrently, e.g. on different cores.
+template <typename T, size_t N>
+class LogQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Appends either all items or none, so multi-record events stay complete
+    bool push(const T *items, size_t count)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        const size_t tail = _tail.load(std::memory_order_acquire);
+        if (N - (head - tail) < count)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            _items[(head + i) % N] = items[i];
+        }
+        _head.store(head + count, std::memory_order_release);
+        return true;
+    }
+
+    // Like push(), but fill(index, item) writes the items in place, so large
+    // events need no copy on the stack of the producer
+    template <typename F>
+    bool emplace(size_t count, F fill)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        const size_t tail = _tail.load(std::memory_order_acquire);
+        if (N - (head - tail) < count)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            fill(i, _items[(head + i) % N]);
+        }
+        _head.store(head + count, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = _items[tail % N];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T _items[N];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+};
@@ -0,0 +1,54 @@
+#include "LogSink.h"
+#include "FileStorage.h"
+
+// Starts the task printing the mirrored records to out
+void LogSerialSink::begin(Print &out)
+{
+    if (_task != nullptr)
+    {
+        return;
+    }
+    _out = &out;
+    xTaskCreatePinnedToCore(printTask, "logMirror", LOG_SERIAL_TASK_STACK, this, LOG_SERIAL_TASK_PRIORITY, &_task, LOG_TASK_CORE);
+}
+
+void LogSerialSink::notify()
+{
+    if (_task != nullptr)
+    {
+        xTaskNotifyGive(_task);
+    }
+}
+
+void LogSerialSink::printTask(void *param)
+{
+    LogSerialSink *sink = static_cast<LogSerialSink *>(param);
+    logRecord_t record;
+    uint8_t pendingNodes = 0;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        sink->_printing = true;
+        while (sink->pop(record))
+        {
+            FileStorage::printRecord(*sink->_out, record, pendingNodes);
+        }
+        sink->_printing = false;
+    }
+}
+
+// Waits until the records handed over so far are printed, e.g. before the
+// Serial is used for something else. Returns false on timeout.
+bool LogSerialSink::waitIdle(uint32_t timeoutMs)
+{
+    const uint32_t started = millis();
+    while (_task != nullptr && (size() > 0 || _printing))
+    {
+        if (millis() - started >= timeoutMs)
+        {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "Arduino.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "LogFormat.h"
+#include "LogQueue.h"
+
+#ifndef LOG_SERIAL_RECORDS
+#define LOG_SERIAL_RECORDS 64 // records waiting to be mirrored, must be a power of two
+#endif
+#define LOG_SERIAL_TASK_STACK 3072
+#define LOG_SERIAL_TASK_PRIORITY 0 // below the logging task, so the mirror never delays flash writes
+
+static_assert(LOG_SERIAL_RECORDS >= 1 + (LOG_MAX_NODES + LOG_NODES_PER_RECORD - 1) / LOG_NODES_PER_RECORD, "LOG_SERIAL_RECORDS too small");
+
+// Detail of the events a sink receives. Every event type has a level and a
+// sink gets the events up to its own level.
+enum logLevel_t : uint8_t
+{
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_INTERACTION = 1, // boot, beats, pictures and sharing
+    LOG_LEVEL_PRESENCE = 2,    // and the encounter checkpoints
+    LOG_LEVEL_ALL = 3          // and every connection change
+};
+
+inline logLevel_t logEventLevel(uint8_t type)
+{
+    switch (type)
+    {
+    case BadgeEvent::ENCOUNTER_EVT:
+        return LOG_LEVEL_PRESENCE;
+    case BadgeEvent::CONNECTION_EVT:
+    case BadgeEvent::NODE_JOIN_EVT:
+    case BadgeEvent::NODE_LEAVE_EVT:
+        return LOG_LEVEL_ALL;
+    default:
+        return LOG_LEVEL_INTERACTION;
+    }
+}
+
+// Receiver of the log records, registered with FileStorage::addSink(). The
+// logging task calls write() for every record of the events up to the level
+// of the sink, so write() must never block: sinks doing slow I/O hand the
+// records over to a consumer of their own and drop them when it falls behind.
+class LogSink
+{
+public:
+    explicit LogSink(logLevel_t level) : _level(level) {}
+    virtual ~LogSink() {}
+
+    logLevel_t level() const { return _level; }
+    void setLevel(logLevel_t level) { _level = level; }
+    size_t dropped() const { return _dropped; }
+
+    virtual void write(const logRecord_t &record) = 0;
+    virtual void flush() {}
+
+protected:
+    std::atomic<size_t> _dropped{0};
+
+private:
+    std::atomic<logLevel_t> _level;
+};
+
+// Hands the records over to a consumer in another task through a queue of N
+// records, e.g. to the loop for the mesh uplink. Events that do not fit into
+// the queue completely are dropped.
+template <size_t N>
+class LogQueueSink : public LogSink
+{
+public:
+    explicit LogQueueSink(logLevel_t level) : LogSink(level) {}
+
+    void write(const logRecord_t &record) override
+    {
+        if (record.type != LOG_RECORD_CONTINUATION)
+        {
+            _skipping = N - _queue.size() < logEventRecords(record);
+        }
+        if (_skipping)
+        {
+            _dropped++;
+            return;
+        }
+        _queue.push(&record, 1);
+        notify();
+    }
+
+    // Called by the consumer
+    bool pop(logRecord_t &record) { return _queue.pop(record); }
+    size_t size() const { return _queue.size(); }
+
+protected:
+    virtual void notify() {}
+
+private:
+    LogQueue<logRecord_t, N> _queue;
+    bool _skipping = false;
+};
+
+// Mirrors the events in readable form, printed by a low priority task so the
+// logging task never waits for the UART
+class LogSerialSink : public LogQueueSink<LOG_SERIAL_RECORDS>
+{
+public:
+    explicit LogSerialSink(logLevel_t level) : LogQueueSink(level) {}
+
+    void begin(Print &out);
+    bool waitIdle(uint32_t timeoutMs);
+
+protected:
+    void notify() override;
+
+private:
+    Print *_out = nullptr;
+    TaskHandle_t _task = nullptr;
+    std::atomic<bool> _printing{false};
+
+    static void printTask(void *param);
+};
+
+// Keeps the latest N records in RAM, e.g. to look at recent events without
+// reading the flash
+template <size_t N>
+class LogRingSink : public LogSink
+{
+public:
+    explicit LogRingSink(logLevel_t level) : LogSink(level) {}
+
+    void write(const logRecord_t &record) override
+    {
+        portENTER_CRITICAL(&_lock);
+        _records[_next % N] = record;
+        _next++;
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    // Calls f(record) for the kept records, oldest first. Copies one record at
+    // a time, so records overwritten meanwhile are skipped. The first records
+    // may be continuations of an event that is gone already.
+    template <typename F>
+    void forEach(F f)
+    {
+        logRecord_t record;
+        for (size_t i = 0;; i++)
+        {
+            portENTER_CRITICAL(&_lock);
+            size_t next = _next;
+            if (next > N && i < next - N)
+            {
+                i = next - N;
+            }
+            bool valid = i < next;
+            if (valid)
+            {
+                record = _records[i % N];
+            }
+            portEXIT_CRITICAL(&_lock);
+            if (!valid)
+            {
+                return;
+            }
+            f(record);
+        }
+    }
+
+private:
+    logRecord_t _records[N];
+    size_t _next = 0;
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+};
@@ -0,0 +1,165 @@
+#include "LogUploader.h"
+
+// Uploads to the collector of the last beacon, as long as it keeps sending them
+void LogUploader::collectorSeen(uint32_t node, uint32_t now)
+{
+    if (node != _collector)
+    {
+        // The new collector tells where to resume with its first answer
+        _collector = node;
+        _awaitingAck = false;
+        _backoff = UPLOAD_ACK_TIMEOUT;
+    }
+    _collectorSeenAt = now;
+}
+
+// Continues at the offset the collector expects, which may also be behind,
+// e.g. after the collector was reset
+void LogUploader::acknowledged(uint32_t from, uint32_t segment, uint32_t offset)
+{
+    if (from != _collector || segment != _segment)
+    {
+        return; // answer to a chunk of an earlier segment
+    }
+    _awaitingAck = false;
+    _backoff = UPLOAD_ACK_TIMEOUT;
+    _offset = offset;
+    if (_offset >= _size)
+    {
+        _segment++;
+        _offset = 0;
+        _storage.setUploadedSegment(_segment);
+#if UPLOAD_DELETE_SEGMENTS
+        _storage.deleteSegment(_segment - 1);
+#endif
+    }
+}
+
+// Holds the upload back until UPLOAD_BONDING_BACKOFF after the last call
+void LogUploader::pause(uint32_t now)
+{
+    _pausedUntil = now + UPLOAD_BONDING_BACKOFF;
+}
+
+// Sends the next chunk when it is due, or the last one again when its
+// acknowledgement did not arrive in time
+void LogUploader::update(uint32_t now)
+{
+    if (_collector == 0)
+    {
+        return;
+    }
+    if (now - _collectorSeenAt > UPLOAD_COLLECTOR_TIMEOUT)
+    {
+        _collector = 0;
+        _awaitingAck = false;
+        return;
+    }
+    if ((int32_t)(_pausedUntil - now) > 0)
+    {
+        return;
+    }
+
+    if (_awaitingAck)
+    {
+        if (now - _sentAt < _backoff)
+        {
+            return;
+        }
+        // The chunk or its answer got lost, or the collector is busy
+        _backoff = std::min<uint32_t>(_backoff * 2, UPLOAD_MAX_BACKOFF);
+    }
+    else if (now - _sentAt < UPLOAD_CHUNK_INTERVAL)
+    {
+        return;
+    }
+    sendChunk(now);
+}
+
+// Sends the chunk at the current offset of the oldest sealed segment not
+// uploaded yet. Segments deleted meanwhile are skipped.
+void LogUploader::sendChunk(uint32_t now)
+{
+    if (_segment == UPLOAD_SEGMENT_NONE)
+    {
+        _segment = _storage.uploadedSegment();
+    }
+    if (_segment < _storage.firstSegment())
+    {
+        _segment = _storage.firstSegment();
+        _offset = 0;
+    }
+
+    for (; _segment < _storage.activeSegment(); _segment++, _offset = 0)
+    {
+        size_t length = _storage.readSegment(_segment, _offset, _chunk, sizeof(_chunk), _size);
+        if (_size > 0)
+        {
+            _send(_collector, _segment, _offset, _size, _chunk, length);
+            _awaitingAck = true;
+            _sentAt = now;
+            return;
+        }
+    }
+    _awaitingAck = false;
+}
+
+// Forwards a chunk that continues the upload of its segment and returns the
+// offset expected next, which the badge receives as acknowledgement
+uint32_t LogCollector::receive(uint32_t from, uint32_t segment, uint32_t offset, uint32_t size, const uint8_t *data, size_t length)
+{
+    upload_t &upload = find(from);
+    if (upload.node != from || upload.segment != segment)
+    {
+        upload = {from, segment, 0, 0};
+    }
+    upload.used = ++_received;
+
+    if (offset != upload.offset || length == 0 || length > UPLOAD_CHUNK_SIZE || offset + length > size)
+    {
+        return upload.offset;
+    }
+
+    logFrameHeader_t header = {};
+    header.sync = LOG_FRAME_SYNC;
+    header.type = LOG_FRAME_SEGMENT;
+    header.version = LOG_FORMAT_VERSION;
+    header.node = from;
+    header.seq = _seq++;
+    header.offset = offset;
+    header.length = sizeof(segment) + length;
+
+    // Written at once, so output of other tasks cannot end up inside the frame
+    uint8_t *p = _frame;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, &segment, sizeof(segment));
+    p += sizeof(segment);
+    memcpy(p, data, length);
+    p += length;
+    uint32_t crc = logCrc32(_frame, p - _frame);
+    memcpy(p, &crc, sizeof(crc));
+    p += sizeof(crc);
+    _out.write(_frame, p - _frame);
+
+    upload.offset += length;
+    return upload.offset;
+}
+
+// The upload of node, or the least recently used one to be taken over
+LogCollector::upload_t &LogCollector::find(uint32_t node)
+{
+    upload_t *oldest = &_uploads[0];
+    for (upload_t &upload : _uploads)
+    {
+        if (upload.node == node)
+        {
+            return upload;
+        }
+        if (upload.used < oldest->used)
+        {
+            oldest = &upload;
+        }
+    }
+    return *oldest;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Arduino.h"
+#include <functional>
+#include "FileStorage.h"
+
+#define UPLOAD_SEGMENT_NONE UINT32_MAX
+
+// Uploads the sealed log segments to a collector node in chunks. Only one
+// chunk is in flight: the collector acknowledges every chunk with the offset
+// it expects next, which is also how a transfer resumes after a reset of
+// either side. Unanswered chunks are sent again with exponential backoff.
+// The upload pauses while the badge is bonding and UPLOAD_BONDING_BACKOFF
+// after, so it never competes with interactive traffic.
+// Times are in ms. Used from the loop only.
+class LogUploader
+{
+public:
+    // Sends a chunk of data at offset of a segment of size bytes to collector
+    typedef std::function<void(uint32_t collector, uint32_t segment, uint32_t offset, uint32_t size, const uint8_t *data, size_t length)> send_t;
+
+    LogUploader(FileStorage &storage, send_t send) : _storage(storage), _send(send) {}
+
+    void collectorSeen(uint32_t node, uint32_t now);
+    void acknowledged(uint32_t from, uint32_t segment, uint32_t offset);
+    void pause(uint32_t now);
+    void update(uint32_t now);
+
+    uint32_t collector() const { return _collector; }
+    uint32_t segment() const { return _segment; }
+    uint32_t offset() const { return _offset; }
+
+private:
+    FileStorage &_storage;
+    send_t _send;
+    uint32_t _collector = 0;
+    uint32_t _collectorSeenAt = 0;
+    uint32_t _segment = UPLOAD_SEGMENT_NONE;
+    uint32_t _offset = 0;
+    uint32_t _size = 0;
+    bool _awaitingAck = false;
+    uint32_t _sentAt = 0;
+    uint32_t _backoff = UPLOAD_ACK_TIMEOUT;
+    uint32_t _pausedUntil = 0;
+    uint8_t _chunk[UPLOAD_CHUNK_SIZE];
+
+    void sendChunk(uint32_t now);
+};
+
+// Receives the chunks on the collector node and forwards them to the host
+// over the serial port as LOG_FRAME_SEGMENT frames (see tools/logreceiver).
+// Remembers the next expected offset of the segment each badge uploads, so
+// chunks arriving twice or out of order are not forwarded.
+class LogCollector
+{
+public:
+    explicit LogCollector(Print &out) : _out(out) {}
+
+    uint32_t receive(uint32_t from, uint32_t segment, uint32_t offset, uint32_t size, const uint8_t *data, size_t length);
+
+private:
+    struct upload_t
+    {
+        uint32_t node;
+        uint32_t segment;
+        uint32_t offset;
+        uint32_t used;
+    };
+
+    Print &_out;
+    upload_t _uploads[UPLOAD_MAX_BADGES] = {};
+    uint32_t _seq = 0;
+    uint32_t _received = 0; // chunks, to find the least recently used upload
+    uint8_t _frame[sizeof(logFrameHeader_t) + sizeof(uint32_t) + UPLOAD_CHUNK_SIZE + sizeof(uint32_t)];
+
+    upload_t &find(uint32_t node);
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+// 64 bit node time in us that does not wrap. It counts a local monotonic 64 bit
+// clock (esp_timer_get_time() on the badge) plus an offset, which keeps the
+// low 32 bits equal to the 32 bit mesh node time. The mesh node time wraps
+// about every 71 minutes and jumps when the time sync of the mesh adjusts it;
+// adjust() applies those jumps to the offset instead of counting them as
+// elapsed time. A jump is taken as the signed 32 bit step, unless that would
+// move the clock before its start, e.g. when a node that just booted syncs to a
+// mesh that has been running for longer than 35 minutes.
+// The high 32 bits depend on the history of the node and are not shared across
+// the mesh; only the low 32 bits are.
+// Not thread safe, it is only used from the loop task, which also runs the
+// mesh callbacks.
+class MeshClock
+{
+public:
+    typedef uint64_t (*localSource_t)();
+    typedef uint32_t (*meshSource_t)();
+
+    MeshClock(localSource_t local, meshSource_t mesh) : _local(local), _mesh(mesh) {}
+
+    // Current node time in us
+    uint64_t now()
+    {
+        if (!_started)
+        {
+            // The mesh may have adjusted its time before, take that as it is
+            _started = true;
+            _adjuster = adjuster(_local());
+            _offset = _adjuster;
+        }
+        return _local() + _offset;
+    }
+
+    uint64_t millis() { return now() / 1000; }
+
+    // Follows a step of the mesh node time, call from onNodeTimeAdjusted
+    void adjust()
+    {
+        if (!_started)
+        {
+            return; // the first now() takes the current mesh node time
+        }
+        const uint64_t local = _local();
+        const uint32_t adjusted = adjuster(local);
+        _offset += (int32_t)(adjusted - _adjuster);
+        _adjuster = adjusted;
+        while ((int64_t)local + _offset < 0)
+        {
+            _offset += 1LL << 32;
+        }
+    }
+
+    // Extends a recent 32 bit node time, e.g. received from another node
+    uint64_t extend(uint32_t time)
+    {
+        uint64_t current = now();
+        return current + (int32_t)(time - (uint32_t)current);
+    }
+
+private:
+    localSource_t _local;
+    meshSource_t _mesh;
+    uint32_t _adjuster = 0; // mesh node time minus the low 32 bits of the local clock
+    int64_t _offset = 0;    // congruent to _adjuster modulo 2^32
+    bool _started = false;
+
+    uint32_t adjuster(uint64_t local) { return _mesh() - (uint32_t)local; }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+// Shared with the host tools in tools/, so it must not depend on the Arduino core
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include "LogFormat.h"
+
+// Sorted set of node ids with a fixed capacity. Connection events are logged as
+// changes against the previous set and replayed from it.
+class NodeSet
+{
+public:
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    const uint32_t *begin() const { return _nodes; }
+    const uint32_t *end() const { return _nodes + _size; }
+    void clear() { _size = 0; }
+
+    bool contains(uint32_t node) const
+    {
+        return std::binary_search(begin(), end(), node);
+    }
+
+    bool insert(uint32_t node)
+    {
+        uint32_t *pos = std::lower_bound(_nodes, _nodes + _size, node);
+        if ((pos != _nodes + _size && *pos == node) || _size == LOG_MAX_NODES)
+        {
+            return false;
+        }
+        std::copy_backward(pos, _nodes + _size, _nodes + _size + 1);
+        *pos = node;
+        _size++;
+        return true;
+    }
+
+    bool remove(uint32_t node)
+    {
+        uint32_t *pos = std::lower_bound(_nodes, _nodes + _size, node);
+        if (pos == _nodes + _size || *pos != node)
+        {
+            return false;
+        }
+        std::copy(pos + 1, _nodes + _size, pos);
+        _size--;
+        return true;
+    }
+
+    // Replaces the content with up to LOG_MAX_NODES ids of an unsorted range
+    template <typename Iterator>
+    void assign(Iterator first, Iterator last)
+    {
+        _size = 0;
+        for (; first != last && _size < LOG_MAX_NODES; ++first)
+        {
+            _nodes[_size++] = *first;
+        }
+        std::sort(_nodes, _nodes + _size);
+        _size = std::unique(_nodes, _nodes + _size) - _nodes;
+    }
+
+private:
+    uint32_t _nodes[LOG_MAX_NODES];
+    size_t _size = 0;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+// Streaming import of the badge roster (BADGES_FILE). The JSON array is read
+// one element at a time into a document of constant size, so the memory
+// needed does not depend on the number of badges in the file.
+// Shared with tools/rosterbench, so it must work with Arduino streams as well
+// as with std::istream.
+
+#include <ArduinoJson.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef ARDUINO
+#include <Stream.h>
+inline int rosterRead(Stream &input) { return input.read(); }
+inline int rosterPeek(Stream &input) { return input.peek(); }
+#else
+#include <istream>
+inline int rosterRead(std::istream &input) { return input.get(); }
+inline int rosterPeek(std::istream &input) { return input.peek(); }
+#endif
+
+// JSON file format key specifications
+#define CONFIG_KEY_ID "id"
+#define CONFIG_KEY_GROUP "group"
+#define CONFIG_KEY_COLOR "color"
+#define CONFIG_KEY_PICS "pics"
+
+// One element of the roster, including room for the copied keys and colour string
+#define ROSTER_ENTRY_MEMORY JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(NUM_PICS) + 48
+#define ROSTER_FILTER_MEMORY JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(1)
+
+struct badges_t
+{
+    uint32_t node;
+    uint8_t group;
+    uint32_t color;
+    uint8_t pics[NUM_PICS];
+};
+
+inline bool rosterSpace(int c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Skips whitespace and returns the next character, -1 at the end of the input
+template <typename TStream>
+int rosterNextToken(TStream &input)
+{
+    int c;
+    do
+    {
+        c = rosterRead(input);
+    } while (rosterSpace(c));
+    return c;
+}
+
+// Skips whitespace and returns the next character without consuming it
+template <typename TStream>
+int rosterPeekToken(TStream &input)
+{
+    while (rosterSpace(rosterPeek(input)))
+    {
+        rosterRead(input);
+    }
+    return rosterPeek(input);
+}
+
+// Calls f(const badges_t &) for every element of the roster array until f
+// returns false. Unknown keys of the elements are dropped while parsing. An
+// error is returned for anything but a complete array, including a roster cut
+// off after an element.
+template <typename TStream, typename F>
+DeserializationError forEachRosterEntry(TStream &input, F f)
+{
+    if (rosterNextToken(input) != '[')
+    {
+        return DeserializationError::InvalidInput;
+    }
+
+    StaticJsonDocument<ROSTER_FILTER_MEMORY> filter;
+    filter[CONFIG_KEY_ID] = true;
+    filter[CONFIG_KEY_GROUP] = true;
+    filter[CONFIG_KEY_COLOR] = true;
+    filter[CONFIG_KEY_PICS] = true;
+
+    // An empty array ends right away
+    if (rosterPeekToken(input) == ']')
+    {
+        return DeserializationError::Ok;
+    }
+
+    StaticJsonDocument<ROSTER_ENTRY_MEMORY> doc;
+    for (;;)
+    {
+        DeserializationError error = deserializeJson(doc, input, DeserializationOption::Filter(filter));
+        if (error)
+        {
+            return error;
+        }
+
+        badges_t badge = {};
+        badge.node = doc[CONFIG_KEY_ID];
+        badge.group = doc[CONFIG_KEY_GROUP];
+        badge.color = (uint32_t)strtoul(doc[CONFIG_KEY_COLOR] | "0", nullptr, 16);
+        JsonArray pics = doc[CONFIG_KEY_PICS];
+        for (size_t i = 0; i < NUM_PICS; i++)
+        {
+            badge.pics[i] = pics[i];
+        }
+        if (!f(badge))
+        {
+            return DeserializationError::Ok;
+        }
+
+        // Elements are separated by commas, the array ends with a bracket
+        const int c = rosterNextToken(input);
+        if (c == ']')
+        {
+            return DeserializationError::Ok;
+        }
+        if (c != ',')
+        {
+            return c < 0 ? DeserializationError::IncompleteInput : DeserializationError::InvalidInput;
+        }
+    }
+}
+
+// Resolves the configuration of nodeid in two passes over the roster: the
+// first finds the badge, the second collects the other members of its group.
+// rewind() has to restart the input at the beginning of the roster. found is
+// only meaningful if no error is returned.
+template <typename TStream, typename TRewind>
+DeserializationError importRosterEntry(TStream &input, TRewind rewind, uint32_t nodeid, badges_t &badge, uint32_t *group, size_t maxGroupSize, bool &found)
+{
+    found = false;
+    DeserializationError error = forEachRosterEntry(input, [&](const badges_t &entry) {
+        if (entry.node != nodeid)
+        {
+            return true;
+        }
+        badge = entry;
+        found = true;
+        return false;
+    });
+    if (error || !found)
+    {
+        return error;
+    }
+
+    rewind();
+    size_t n = 0;
+    error = forEachRosterEntry(input, [&](const badges_t &entry) {
+        if (entry.group == badge.group && entry.node != nodeid)
+        {
+            group[n++] = entry.node;
+        }
+        return n < maxGroupSize;
+    });
+    for (size_t i = n; i < maxGroupSize; i++)
+    {
+        group[i] = 0;
+    }
+    return error;
+}
@@ -11,6 +11,130 @@ RTC_DATA_ATTR size_t currentPicture = 0;
 uint8_t _numnodes = 0;
 float _voltage = 0;
 
+// What the render task needs of the state the loop changes, copied with every
+// command, so the task on the other core never reads the originals
+struct screenState_t
+{
+    uint8_t picture; // shown on the homescreen
+    uint8_t numPics;
+    uint8_t pics[NUM_BADGES * NUM_PICS]; // owned pictures
+    uint8_t numnodes;
+    float voltage;
+};
+
+// Screen commands waiting for the render task, which does all drawing. The
+// commands are collapsed as they arrive: a message or the homescreen replaces
+// the screen still pending, so a burst of requests is drawn as one frame.
+struct screenCommands_t
+{
+    bool frame;      // a message or the homescreen is pending
+    bool homescreen; // the homescreen, otherwise message
+    char message[SCREEN_MESSAGE_LENGTH];
+    bool status;     // the status texts changed
+    bool cache;      // decode the next picture into the cache
+    Print *benchmark; // run the render benchmark, printing to it
+    screenState_t state; // as of the latest command
+};
+
+void screenTask(void *param);
+void drawHomescreen();
+void drawMessage(const char *msg);
+void refreshStatusBar();
+bool decodeNextPicture();
+void runRenderBenchmark(Print &out);
+
+TaskHandle_t _screenTask = nullptr;
+portMUX_TYPE _screenLock = portMUX_INITIALIZER_UNLOCKED;
+screenCommands_t _screenCommands = {};
+screenState_t _screenState = {}; // copy of the render task
+uint32_t _framesRequested = 0;
+uint32_t _framesDrawn = 0;
+
+// The status bar is drawn into a sprite on top of the pixels of the picture
+// behind it, which are saved while the picture is drawn. A change of the
+// status then redraws the bar only, not the whole picture.
+TFT_eSprite _statusBar(&tft);
+uint16_t _statusBackground[PICTURE_MAX_WIDTH * STATUS_BAR_HEIGHT];
+bool _homescreenShown = false;
+uint8_t _shownNumnodes = 0;
+bool _shownBatteryLow = false;
+
+// Header of a cached picture, followed by width * height RGB565 pixels row by
+// row, as the decoder delivered them. jpgSize ties the cache to the JPEG it
+// was decoded from, so uploading a new filesystem image invalidates it.
+struct pictureCacheHeader_t
+{
+    uint32_t magic;
+    uint32_t jpgSize;
+    uint16_t width;
+    uint16_t height;
+};
+
+std::atomic<uint32_t> _checkedPictures{0}; // bit per entry of imgfiles whose cache file was looked at
+std::atomic<uint32_t> _cachedPictures{0};  // bit per entry of imgfiles with a valid cache file
+
+// Decoded blocks are collected into strips of the full width, then written to
+// the cache file. The strips also buffer the pixels read from the cache, one
+// is read while the other is pushed to the screen.
+fs::File _cacheFile;
+pictureCacheHeader_t _cacheHeader;
+bool _cacheFailed = false;
+bool _drawing = true;
+int16_t _stripY = -1;
+uint16_t _stripRows = 0;
+uint16_t _strip[2][PICTURE_MAX_WIDTH * PICTURE_STRIP_ROWS];
+
+// With DMA, pushImageDMA() copies each decoded block into one of two buffers
+// and returns while the SPI sends it, so the next block is decoded meanwhile.
+// The copy is needed because the decoder reuses its block buffer.
+bool _dma = false;
+uint8_t _dmaBlock = 0;
+uint16_t _dmaBlocks[2][PICTURE_STRIP_ROWS * PICTURE_STRIP_ROWS];
+
+void flushStrip()
+{
+    if (_stripRows == 0)
+        return;
+    size_t length = _stripRows * _cacheHeader.width * sizeof(uint16_t);
+    if (_cacheFile.write((const uint8_t *)_strip[0], length) != length)
+        _cacheFailed = true;
+    _stripRows = 0;
+}
+
+// Copies a decoded block into the strip, clipped to the cached picture
+void cacheBlock(int16_t x, int16_t y, uint16_t w, uint16_t h, const uint16_t *bitmap)
+{
+    if (y != _stripY)
+    {
+        flushStrip();
+        _stripY = y;
+    }
+    if (x >= _cacheHeader.width || y >= _cacheHeader.height)
+        return;
+
+    uint16_t columns = std::min<uint16_t>(w, _cacheHeader.width - x);
+    uint16_t rows = std::min<uint16_t>(h, _cacheHeader.height - y);
+    for (uint16_t row = 0; row < rows; row++)
+    {
+        memcpy(&_strip[0][row * _cacheHeader.width + x], &bitmap[row * w], columns * sizeof(uint16_t));
+    }
+    _stripRows = std::max(_stripRows, rows);
+}
+
+// Keeps the rows of a block that lie behind the status bar
+void saveBackground(int16_t x, int16_t y, uint16_t w, uint16_t h, const uint16_t *bitmap)
+{
+    const int16_t top = tft.height() - STATUS_BAR_HEIGHT;
+    if (y + h <= top || x >= tft.width())
+        return;
+
+    uint16_t columns = std::min<uint16_t>(w, tft.width() - x);
+    for (uint16_t row = std::max(0, top - y); row < h && y + row < tft.height(); row++)
+    {
+        memcpy(&_statusBackground[(y + row - top) * tft.width() + x], &bitmap[row * w], columns * sizeof(uint16_t));
+    }
+}
+
 // This next function will be called during decoding of the jpeg file to
 // render each block to the TFT.  If you use a different TFT library
 // you will need to adapt this function to suit.
@@ -20,8 +144,21 @@ bool tft_output(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t *bitmap)
     if (y >= tft.height())
         return 0;
 
+    if (_cacheFile)
+        cacheBlock(x, y, w, h, bitmap);
+
+    if (!_drawing)
+        return 1;
+    saveBackground(x, y, w, h, bitmap);
+
     // This function will clip the image block rendering automatically at the TFT boundaries
-    tft.pushImage(x, y, w, h, bitmap);
+    if (_dma)
+    {
+        tft.pushImageDMA(x, y, w, h, bitmap, _dmaBlocks[_dmaBlock]);
+        _dmaBlock ^= 1;
+    }
+    else
+        tft.pushImage(x, y, w, h, bitmap);
 
     // This might work instead if you adapt the sketch to use the Adafruit_GFX library
     // tft.drawRGBBitmap(x, y, bitmap, w, h);
@@ -41,23 +178,212 @@ void initScreen()
 
     TJpgDec.setJpgScale(1);
     TJpgDec.setCallback(tft_output);
+#if SCREEN_DMA
+    _dma = tft.initDMA();
+#endif
+
+    _statusBar.createSprite(tft.width(), STATUS_BAR_HEIGHT);
+    _statusBar.setSwapBytes(true);
+    _statusBar.setTextSize(2);
+
+    xTaskCreatePinnedToCore(screenTask, "screenTask", SCREEN_TASK_STACK, nullptr, SCREEN_TASK_PRIORITY, &_screenTask, SCREEN_TASK_CORE);
+}
+
+// Queues a command for the render task, update changes the pending commands
+// under the lock. Called from the loop, which owns configuration and
+// currentPicture.
+template <typename F>
+void postScreenCommand(F update)
+{
+    portENTER_CRITICAL(&_screenLock);
+    update(_screenCommands);
+    screenState_t &state = _screenCommands.state;
+    state.picture = currentPicture < configuration.numPics ? configuration.pics[currentPicture] : 0;
+    state.numPics = std::min(configuration.numPics, sizeof(state.pics));
+    memcpy(state.pics, configuration.pics, state.numPics);
+    state.numnodes = _numnodes;
+    state.voltage = _voltage;
+    portEXIT_CRITICAL(&_screenLock);
+    if (_screenTask != nullptr)
+        xTaskNotifyGive(_screenTask);
+}
+
+// Draws the latest requested screen, then runs the background work
+void screenTask(void *param)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&_screenLock);
+        screenCommands_t commands = _screenCommands;
+        _screenCommands = {};
+        portEXIT_CRITICAL(&_screenLock);
+        _screenState = commands.state;
+
+        if (commands.frame)
+        {
+            if (commands.homescreen)
+                drawHomescreen();
+            else
+                drawMessage(commands.message);
+            _framesDrawn++;
+        }
+        else if (commands.status)
+            refreshStatusBar();
+        if (commands.cache)
+            decodeNextPicture();
+        if (commands.benchmark != nullptr)
+            runRenderBenchmark(*commands.benchmark);
+    }
+}
+
+// The transaction stays open for all blocks or strips of a picture, DMA
+// cannot start a new one
+void beginPicture()
+{
+    if (_dma)
+        tft.startWrite();
+}
+
+void endPicture()
+{
+    if (_dma)
+    {
+        tft.dmaWait();
+        tft.endWrite();
+    }
+}
+
+// Sends the strip in buffer current at y. With DMA, it waits for the previous
+// strip, then sends this one while the next is prepared in the other buffer.
+// Strips are not copied, but swapped in place.
+void pushStrip(uint16_t y, uint16_t width, uint16_t rows, uint8_t &current)
+{
+    saveBackground(0, y, width, rows, _strip[current]);
+    if (_dma)
+    {
+        tft.pushImageDMA(0, y, width, rows, _strip[current]);
+        current ^= 1;
+    }
+    else
+        tft.pushImage(0, y, width, rows, _strip[current]);
+}
+
+// Decodes pic from its JPEG straight to the screen
+void drawJpgPicture(uint8_t pic)
+{
+    char picturefilename[24];
+    sprintf(picturefilename, "/%s.jpg", imgfiles[pic]);
+    beginPicture();
+    TJpgDec.drawFsJpg(0, 0, picturefilename, STORAGE);
+    endPicture();
+}
+
+// Decompresses pic from the firmware into strips as they are sent
+bool drawBuiltinPicture(uint8_t pic)
+{
+    const builtinImage_t *image = findBuiltinImage(imgfiles[pic]);
+    if (image == nullptr || image->width > PICTURE_MAX_WIDTH)
+        return false;
+
+    beginPicture();
+    const uint8_t *data = image->data;
+    uint8_t current = 0;
+    for (uint16_t y = 0; y < image->height && y < tft.height(); y += PICTURE_STRIP_ROWS)
+    {
+        uint16_t rows = std::min<uint16_t>(PICTURE_STRIP_ROWS, image->height - y);
+        data = decodeBuiltinRows(*image, data, rows, _strip[current]);
+        pushStrip(y, image->width, rows, current);
+    }
+    endPicture();
+    return true;
+}
+
+// Draws the status texts aligned to bottom, on the screen or the sprite
+void drawStatusText(TFT_eSPI &canvas, int32_t bottom)
+{
+    if (_screenState.numnodes > 0)
+    {
+        canvas.setTextColor(TFT_BLACK, TFT_WHITE);
+        canvas.setTextDatum(BL_DATUM);
+        canvas.drawString(String(_screenState.numnodes) + " close", 0, bottom);
+        canvas.setTextColor(TFT_WHITE);
+    }
+    else
+    {
+        canvas.setTextColor(TFT_BLACK, TFT_WHITE);
+        canvas.setTextDatum(BL_DATUM);
+        canvas.drawString("No one around", 0, bottom);
+        canvas.setTextColor(TFT_WHITE);
+    }
+
+    if (_screenState.voltage < 3.3)
+    {
+        canvas.setTextColor(TFT_WHITE, TFT_RED);
+        canvas.setTextDatum(BR_DATUM);
+        canvas.drawString("Battery low", canvas.width(), bottom);
+        canvas.setTextColor(TFT_WHITE);
+    }
+}
+
+void drawStatusBar()
+{
+    _shownNumnodes = _screenState.numnodes;
+    _shownBatteryLow = _screenState.voltage < 3.3;
+    if (!_statusBar.created())
+    {
+        // Not enough memory for the sprite, the texts go straight over the picture
+        drawStatusText(tft, tft.height());
+        return;
+    }
+    _statusBar.pushImage(0, 0, _statusBar.width(), STATUS_BAR_HEIGHT, _statusBackground);
+    drawStatusText(_statusBar, STATUS_BAR_HEIGHT);
+    _statusBar.pushSprite(0, tft.height() - STATUS_BAR_HEIGHT);
+}
+
+// Redraws the status bar if the homescreen is shown and its texts changed.
+// Called by the render task.
+void refreshStatusBar()
+{
+    if (!_homescreenShown || (_screenState.numnodes == _shownNumnodes && (_screenState.voltage < 3.3) == _shownBatteryLow))
+        return;
+    if (_statusBar.created())
+        drawStatusBar();
+    else
+        drawHomescreen();
 }
 
 void updateNumNodes(uint8_t numnodes) {
     _numnodes = numnodes;
+    postScreenCommand([](screenCommands_t &c) { c.status = true; });
 }
 
 void updateVoltage(float voltage) {
     _voltage = voltage;
+    postScreenCommand([](screenCommands_t &c) { c.status = true; });
 }
 
-void displayMessage(String msg)
+void drawMessage(const char *msg)
 {
+    _homescreenShown = false;
     tft.fillScreen(TFT_BLACK);
     tft.setTextDatum(MC_DATUM);
     tft.drawString(msg, tft.width() / 2, tft.height() / 2);
 }
 
+// Shows msg once the render task gets to it, unless another screen is
+// requested before
+void displayMessage(String msg)
+{
+    _framesRequested++;
+    postScreenCommand([&msg](screenCommands_t &c) {
+        c.frame = true;
+        c.homescreen = false;
+        strlcpy(c.message, msg.c_str(), sizeof(c.message));
+    });
+}
+
 void nextPicture()
 {
     currentPicture++;
@@ -68,44 +394,198 @@ void nextPicture()
     showHomescreen();
 }
 
-void showHomescreen()
+void pictureCachePath(char *path, uint8_t pic)
 {
-    // Time recorded for test purposes
-    // uint32_t t = millis();
+    sprintf(path, PICTURE_CACHE_FILE, imgfiles[pic]);
+}
 
-    char picturefilename[24];
-    sprintf(picturefilename, "/%s.jpg", imgfiles[configuration.pics[currentPicture]]);
-    TJpgDec.drawFsJpg(0, 0, picturefilename);
-    yield();
+// Opens the cache file of pic if it belongs to the current JPEG and is complete
+fs::File openCachedPicture(uint8_t pic, pictureCacheHeader_t &header)
+{
+    char jpgfilename[24];
+    char path[24];
+    sprintf(jpgfilename, "/%s.jpg", imgfiles[pic]);
+    pictureCachePath(path, pic);
 
-    //Status bar
-    if (_numnodes > 0)
+    fs::File jpg = STORAGE.open(jpgfilename);
+    size_t jpgSize = jpg ? jpg.size() : 0;
+    jpg.close();
+
+    fs::File file = STORAGE.open(path);
+    if (file && file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+        header.magic == PICTURE_CACHE_MAGIC && header.jpgSize == jpgSize && header.width <= PICTURE_MAX_WIDTH &&
+        file.size() == sizeof(header) + (size_t)header.width * header.height * sizeof(uint16_t))
     {
-        tft.setTextColor(TFT_BLACK, TFT_WHITE);
-        tft.setTextDatum(BL_DATUM);
-        tft.drawString(String(_numnodes) + " close", 0, tft.height());
-        tft.setTextColor(TFT_WHITE);
+        return file;
     }
-    else
+    file.close();
+    return fs::File();
+}
+
+// Decodes pic into its cache file without drawing it. Skipped when the cache
+// would leave less than a log segment free.
+bool cachePicture(uint8_t pic)
+{
+    char jpgfilename[24];
+    char path[24];
+    sprintf(jpgfilename, "/%s.jpg", imgfiles[pic]);
+    pictureCachePath(path, pic);
+
+    fs::File jpg = STORAGE.open(jpgfilename);
+    if (!jpg)
+        return false;
+    _cacheHeader = {PICTURE_CACHE_MAGIC, (uint32_t)jpg.size(), 0, 0};
+    jpg.close();
+    uint16_t w = 0, h = 0;
+    TJpgDec.getFsJpgSize(&w, &h, jpgfilename, STORAGE);
+    _cacheHeader.width = std::min<uint16_t>(w, tft.width());
+    _cacheHeader.height = std::min<uint16_t>(h, tft.height());
+
+    fs::File old = STORAGE.open(path);
+    size_t oldSize = old ? old.size() : 0;
+    old.close();
+    size_t size = sizeof(_cacheHeader) + (size_t)_cacheHeader.width * _cacheHeader.height * sizeof(uint16_t);
+    if (_cacheHeader.width == 0 || fileStorage.usedBytes() + size - oldSize + LOG_SEGMENT_SIZE > fileStorage.totalBytes())
+        return false;
+
+    _cacheFile = STORAGE.open(path, FILE_WRITE);
+    if (!_cacheFile)
+        return false;
+    _cacheFailed = _cacheFile.write((const uint8_t *)&_cacheHeader, sizeof(_cacheHeader)) != sizeof(_cacheHeader);
+    _stripY = -1;
+    _stripRows = 0;
+    _drawing = false;
+    TJpgDec.drawFsJpg(0, 0, jpgfilename, STORAGE);
+    flushStrip();
+    _drawing = true;
+    _cacheFailed |= _cacheFile.size() != size;
+    _cacheFile.close();
+
+    if (_cacheFailed)
+    {
+        STORAGE.remove(path);
+        size = 0;
+    }
+    fileStorage.fileReplaced(oldSize, size);
+    return !_cacheFailed;
+}
+
+// Pushes the cached pixels of pic to the screen strip by strip
+bool drawCachedPicture(uint8_t pic)
+{
+    if (!(_cachedPictures & (1 << pic)))
+        return false;
+
+    pictureCacheHeader_t header;
+    fs::File file = openCachedPicture(pic, header);
+    if (!file)
+    {
+        _checkedPictures &= ~(1 << pic);
+        _cachedPictures &= ~(1 << pic);
+        return false;
+    }
+    beginPicture();
+    uint8_t current = 0;
+    for (uint16_t y = 0; y < header.height; y += PICTURE_STRIP_ROWS)
+    {
+        uint16_t rows = std::min<uint16_t>(PICTURE_STRIP_ROWS, header.height - y);
+        size_t length = rows * header.width * sizeof(uint16_t);
+        if (file.read((uint8_t *)_strip[current], length) != length)
+            break;
+        pushStrip(y, header.width, rows, current);
+    }
+    endPicture();
+    file.close();
+    return true;
+}
+
+// The owned pictures changed, e.g. after bonding. Cached pictures are checked
+// again and the new ones are decoded by cacheNextPicture(). A picture the
+// render task is decoding meanwhile stays valid, the files do not change.
+void invalidatePictureCache()
+{
+    _checkedPictures = 0;
+    _cachedPictures = 0;
+}
+
+// Checks the cache of the next owned picture not checked yet and decodes it
+// if needed. Returns false once every owned picture was checked.
+bool decodeNextPicture()
+{
+    for (size_t i = 0; i < _screenState.numPics; i++)
+    {
+        uint8_t pic = _screenState.pics[i];
+        if (_checkedPictures & (1 << pic))
+            continue;
+        _checkedPictures |= 1 << pic;
+        if (findBuiltinImage(imgfiles[pic]) != nullptr)
+            continue; // drawn from the firmware, faster than from the cache
+
+        pictureCacheHeader_t header;
+        fs::File file = openCachedPicture(pic, header);
+        bool cached = (bool)file;
+        file.close();
+        if (cached || cachePicture(pic))
+            _cachedPictures |= 1 << pic;
+        return true;
+    }
+    return false;
+}
+
+// Lets the render task decode a picture into the cache between two screens
+void cacheNextPicture()
+{
+    postScreenCommand([](screenCommands_t &c) { c.cache = true; });
+}
+
+bool pictureCacheComplete()
+{
+    for (size_t i = 0; i < configuration.numPics; i++)
     {
-        tft.setTextColor(TFT_BLACK, TFT_WHITE);
-        tft.setTextDatum(BL_DATUM);
-        tft.drawString("No one around", 0, tft.height());
-        tft.setTextColor(TFT_WHITE);
+        if (!(_checkedPictures & (1 << configuration.pics[i])))
+            return false;
     }
+    return true;
+}
 
-    if (_voltage < 3.3)
+void drawHomescreen()
+{
+#if RENDER_TIMING
+    uint32_t t = micros();
+#endif
+
+    // Built into the firmware, decoded before or from the JPEG
+    const uint8_t pic = _screenState.picture;
+    const char *source __attribute__((unused)) = "flash"; // for RENDER_TIMING
+    if (!drawBuiltinPicture(pic))
     {
-        tft.setTextColor(TFT_WHITE, TFT_RED);
-        tft.setTextDatum(BR_DATUM);
-        tft.drawString("Battery low", tft.width(), tft.height());
-        tft.setTextColor(TFT_WHITE);
+        source = "cache";
+        if (!drawCachedPicture(pic))
+        {
+            source = "JPEG";
+            drawJpgPicture(pic);
+        }
     }
+    yield();
+
+    //Status bar
+    drawStatusBar();
+    _homescreenShown = true;
 
     // How much time did rendering take (ESP8266 80MHz 271ms, 160MHz 157ms, ESP32 SPI 120ms, 8bit parallel 105ms
-    // t = millis() - t;
-    // Serial.print(t);
-    // Serial.println(" ms");
+#if RENDER_TIMING
+    Serial.printf("Homescreen from %s in %lu us\r\n", source, micros() - t);
+#endif
+}
+
+// Shows the current picture once the render task gets to it
+void showHomescreen()
+{
+    _framesRequested++;
+    postScreenCommand([](screenCommands_t &c) {
+        c.frame = true;
+        c.homescreen = true;
+    });
 }
 
 size_t getCurrentPicture()
@@ -116,4 +596,62 @@ size_t getCurrentPicture()
 void setCurrentPicture(size_t picId) {
     currentPicture = picId;
     showHomescreen();
-}
\ No newline at end of file
+}
+
+// Renders every owned picture RENDER_BENCH_RUNS times from the JPEG, the cache
+// and the firmware, each with and without DMA, and prints the times. Ends on the
+// homescreen. Run by the render task, see benchmarkRender().
+void runRenderBenchmark(Print &out)
+{
+    const bool dma = _dma;
+    out.printf("Render benchmark, %u runs per picture and path\r\n", RENDER_BENCH_RUNS);
+    for (size_t i = 0; i < _screenState.numPics; i++)
+    {
+        uint8_t pic = _screenState.pics[i];
+        static const char *sources[] = {"JPEG", "cache", "flash"};
+        for (uint8_t path = 0; path < 6; path++)
+        {
+            uint8_t source = path >> 1;
+            if (((path & 1) && !dma) || (source == 1 && !(_cachedPictures & (1 << pic))) ||
+                (source == 2 && findBuiltinImage(imgfiles[pic]) == nullptr))
+                continue; // DMA unavailable, not cached or not built in
+            _dma = path & 1;
+
+            uint32_t min = UINT32_MAX, max = 0, sum = 0;
+            for (uint8_t run = 0; run < RENDER_BENCH_RUNS; run++)
+            {
+                uint32_t t = micros();
+                if (source == 0)
+                    drawJpgPicture(pic);
+                else if (source == 1)
+                    drawCachedPicture(pic);
+                else
+                    drawBuiltinPicture(pic);
+                t = micros() - t;
+                min = std::min(min, t);
+                max = std::max(max, t);
+                sum += t;
+                yield();
+            }
+            out.printf("%-10s %-5s %-4s avg %6u us  min %6u us  max %6u us\r\n", imgfiles[pic], sources[source],
+                       _dma ? "DMA" : "sync", sum / RENDER_BENCH_RUNS, min, max);
+        }
+    }
+    _dma = dma;
+    drawHomescreen();
+}
+
+void benchmarkRender(Print &out)
+{
+    postScreenCommand([&out](screenCommands_t &c) { c.benchmark = &out; });
+}
+
+uint32_t screenFramesRequested()
+{
+    return _framesRequested;
+}
+
+uint32_t screenFramesDrawn()
+{
+    return _framesDrawn;
+}
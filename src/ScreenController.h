@@ -1,12 +1,24 @@
 #pragma once
 
 #include "Arduino.h"
+#include <freertos/FreeRTOS.h>
 #include <FS.h>
-#include "SPIFFS.h" // For ESP32 only
+#include "Storage.h"
 #include <SPI.h>
 #include <TJpg_Decoder.h>
 #include <TFT_eSPI.h>
 #include "FileStorage.h"
+#include "BuiltinImages.h"
+
+#define PICTURE_CACHE_MAGIC 0x35364744 // "DG65" in little endian
+#define PICTURE_STRIP_ROWS 16           // MCU blocks of a JPEG are at most 16 rows high
+#define PICTURE_MAX_WIDTH (TFT_WIDTH > TFT_HEIGHT ? TFT_WIDTH : TFT_HEIGHT)
+#define RENDER_BENCH_RUNS 10
+#define STATUS_BAR_HEIGHT 16 // text size 2 of the built-in font
+#define SCREEN_TASK_CORE 0 // next to the logging task, the loop and with it the mesh run on core 1
+#define SCREEN_TASK_PRIORITY 1
+#define SCREEN_TASK_STACK 8192 // as the loop task, which decoded the pictures before
+#define SCREEN_MESSAGE_LENGTH 48
 
 void updateNumNodes(uint8_t numnodes);
 void updateVoltage(float voltage);
@@ -16,6 +28,13 @@ void showHomescreen();
 void nextPicture();
 size_t getCurrentPicture();
 void setCurrentPicture(size_t picId);
+void invalidatePictureCache();
+void cacheNextPicture();
+bool pictureCacheComplete();
+void benchmarkRender(Print &out);
+uint32_t screenFramesRequested();
+uint32_t screenFramesDrawn();
 
 extern TFT_eSPI tft; // Invoke custom TFT library
-extern badgeConfig_t configuration;
\ No newline at end of file
+extern badgeConfig_t configuration;
+extern FileStorage fileStorage;
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+// Filesystem on the data partition, selected with a build flag of the
+// PlatformIO environment. SPIFFS and LittleFS share the fs::FS interface for
+// files, but begin(), usedBytes() and totalBytes() are only declared by the
+// concrete classes, so the filesystem is picked at compile time.
+//
+//   -D STORAGE_LITTLEFS=1   LittleFS (board_build.filesystem = littlefs)
+//   otherwise               SPIFFS
+
+#include <FS.h>
+
+#if STORAGE_LITTLEFS
+#include <LittleFS.h>
+#define STORAGE LittleFS
+#define STORAGE_NAME "LittleFS"
+#else
+#include "SPIFFS.h"
+#define STORAGE SPIFFS
+#define STORAGE_NAME "SPIFFS"
+#endif
@@ -0,0 +1,171 @@
+// Benchmark of the filesystem selected in Storage.h, built instead of the
+// application by the bench-* environments in platformio.ini. It measures the
+// operations the badge depends on: appending log records, opening files as
+// their number grows and reading the pictures shown on the display.
+// Upload the filesystem image of the same environment first, so the pictures
+// are present. Files created by the benchmark are removed afterwards.
+
+#if STORAGE_BENCHMARK
+
+#include "Arduino.h"
+#include "Storage.h"
+#include "LogFormat.h"
+
+#define BENCH_APPENDS 500 // log records appended with one open and close each
+#define BENCH_BATCH 96 // records per batch, as LOG_BUFFER_RECORDS
+#define BENCH_MAX_FILES 128
+#define BENCH_OPENS 50 // opens measured per file count
+#define BENCH_READ_BLOCK 4096
+#define BENCH_FILE "/bench%03u.bin"
+
+struct latency_t
+{
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+    uint32_t count = 0;
+
+    void add(uint32_t us)
+    {
+        min = std::min(min, us);
+        max = std::max(max, us);
+        sum += us;
+        count++;
+    }
+
+    void print(const char *name) const
+    {
+        Serial.printf("%-28s avg %6u us  min %6u us  max %6u us\r\n", name, count ? (uint32_t)(sum / count) : 0, min, max);
+    }
+};
+
+static void benchPath(char *path, uint32_t n)
+{
+    snprintf(path, 24, BENCH_FILE, n);
+}
+
+// Appends records the way the logging task does, one open per batch
+static void benchAppend()
+{
+    char path[24];
+    benchPath(path, 0);
+    STORAGE.remove(path);
+
+    logRecord_t records[BENCH_BATCH] = {};
+    latency_t single, batch;
+    for (uint32_t i = 0; i < BENCH_APPENDS; i++)
+    {
+        uint32_t t = micros();
+        fs::File file = STORAGE.open(path, FILE_APPEND);
+        file.write((const uint8_t *)records, sizeof(logRecord_t));
+        file.close();
+        single.add(micros() - t);
+    }
+    for (uint32_t i = 0; i < BENCH_APPENDS / 10; i++)
+    {
+        uint32_t t = micros();
+        fs::File file = STORAGE.open(path, FILE_APPEND);
+        file.write((const uint8_t *)records, sizeof(records));
+        file.close();
+        batch.add(micros() - t);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "append %u records", BENCH_BATCH);
+    single.print("append 1 record");
+    batch.print(name);
+    STORAGE.remove(path);
+}
+
+// Opens an existing file while the number of files on the filesystem grows
+static void benchOpen()
+{
+    char path[24];
+    uint32_t files = 0;
+    for (uint32_t target = 1; target <= BENCH_MAX_FILES; target *= 2)
+    {
+        for (; files < target; files++)
+        {
+            benchPath(path, files);
+            fs::File file = STORAGE.open(path, FILE_WRITE);
+            file.write((const uint8_t *)path, sizeof(path));
+            file.close();
+        }
+
+        latency_t open;
+        for (uint32_t i = 0; i < BENCH_OPENS; i++)
+        {
+            benchPath(path, random(files));
+            uint32_t t = micros();
+            fs::File file = STORAGE.open(path);
+            file.close();
+            open.add(micros() - t);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "open with %u files", files);
+        open.print(name);
+    }
+
+    for (uint32_t i = 0; i < files; i++)
+    {
+        benchPath(path, i);
+        STORAGE.remove(path);
+    }
+}
+
+// Reads every JPEG in the root directory in blocks, like the decoder does
+static void benchJpeg()
+{
+    uint8_t *block = (uint8_t *)malloc(BENCH_READ_BLOCK);
+    size_t total = 0;
+    uint32_t elapsed = 0;
+    fs::File root = STORAGE.open("/");
+    fs::File entry = root.openNextFile();
+    while (entry)
+    {
+        String name = entry.name();
+        entry.close();
+        if (name.endsWith(".jpg"))
+        {
+            if (!name.startsWith("/"))
+                name = "/" + name;
+            uint32_t t = micros();
+            fs::File file = STORAGE.open(name);
+            size_t read;
+            while (file && (read = file.read(block, BENCH_READ_BLOCK)) > 0)
+            {
+                total += read;
+            }
+            file.close();
+            elapsed += micros() - t;
+        }
+        entry = root.openNextFile();
+    }
+    root.close();
+    free(block);
+
+    Serial.printf("%-28s %u bytes in %u us, %u KB/s\r\n", "read pictures", total, elapsed,
+                  elapsed ? (uint32_t)((uint64_t)total * 1000000 / elapsed / 1024) : 0);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(1000);
+    if (!STORAGE.begin())
+    {
+        Serial.println(STORAGE_NAME " initialisation failed!");
+        return;
+    }
+    Serial.printf("Benchmark of %s, %u of %u bytes used\r\n", STORAGE_NAME, STORAGE.usedBytes(), STORAGE.totalBytes());
+    benchAppend();
+    benchOpen();
+    benchJpeg();
+    Serial.println("Benchmark done");
+}
+
+void loop()
+{
+    delay(1000);
+}
+
+#endif
@@ -0,0 +1,624 @@
+// logdecode - Decodes interaction logs of many badges into columnar tables
+//
+// Reads binary logs (segment files or the stream written by logreceiver) as
+// well as text dumps of printLog() with one JSON object per event, optionally
+// wrapped in LOGSTART<nodeId> and LOGEND. Files are decoded in parallel and
+// streamed in blocks. The rows of every file are written to part files as they
+// are decoded and joined in input order at the end, so memory does not grow
+// with the logs. Every event type becomes one table, written as CSV or as one
+// raw little endian file per column.
+//
+// Usage: logdecode [-f csv|bin] [-o outdir] [-j threads] <log file>...
+
+#include "LogFormat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum columnType_t
+{
+    COLUMN_U8,
+    COLUMN_I32,
+    COLUMN_U32,
+    COLUMN_U64
+};
+
+struct Column
+{
+    const char *name;
+    columnType_t type;
+};
+
+// Writes the rows of a table as they are decoded, to a CSV file or to one file
+// of packed values per column
+struct Table
+{
+    Table(const char *name, std::vector<Column> columns) : name(name), columns(columns) {}
+
+    const char *name;
+    std::vector<Column> columns;
+    std::vector<FILE *> files;
+    size_t rows = 0;
+
+    void add(std::initializer_list<int64_t> row)
+    {
+        if (files.size() == 1)
+        {
+            size_t i = 0;
+            for (int64_t value : row)
+            {
+                fprintf(files[0], i++ == 0 ? "%lld" : ",%lld", (long long)value);
+            }
+            fputc('\n', files[0]);
+        }
+        else
+        {
+            size_t i = 0;
+            for (int64_t value : row)
+            {
+                writeValue(files[i], columns[i].type, value);
+                i++;
+            }
+        }
+        rows++;
+    }
+
+    static void writeValue(FILE *file, columnType_t type, int64_t value)
+    {
+        if (type == COLUMN_U8)
+        {
+            uint8_t v = value;
+            fwrite(&v, sizeof(v), 1, file);
+        }
+        else if (type == COLUMN_U64)
+        {
+            uint64_t v = value;
+            fwrite(&v, sizeof(v), 1, file);
+        }
+        else
+        {
+            uint32_t v = (uint32_t)value;
+            fwrite(&v, sizeof(v), 1, file);
+        }
+    }
+};
+
+enum connectionKind_t
+{
+    CONNECTION_KEYFRAME, // node listed in a full snapshot, node 0 for an empty one
+    CONNECTION_JOIN,
+    CONNECTION_LEAVE
+};
+
+// One table per event type, all starting with the badge, node time and wall
+// clock, except for encounters, which have no wall clock but the first seen time
+struct Tables
+{
+    Table power{"power", {{"badge", COLUMN_U32}, {"t", COLUMN_U64}, {"s", COLUMN_U32}}};
+    Table beats{"beats", {{"badge", COLUMN_U32}, {"t", COLUMN_U64}, {"s", COLUMN_U32}, {"n", COLUMN_U32}, {"b", COLUMN_I32}}};
+    Table pictures{"pictures", {{"badge", COLUMN_U32}, {"t", COLUMN_U64}, {"s", COLUMN_U32}, {"p", COLUMN_U8}}};
+    Table shares{"shares", {{"badge", COLUMN_U32}, {"t", COLUMN_U64}, {"s", COLUMN_U32}, {"n", COLUMN_U32}, {"p", COLUMN_U8}}};
+    Table connections{"connections", {{"badge", COLUMN_U32}, {"t", COLUMN_U64}, {"s", COLUMN_U32}, {"kind", COLUMN_U8}, {"n", COLUMN_U32}}};
+    Table encounters{"encounters", {{"badge", COLUMN_U32}, {"t", COLUMN_U64}, {"first", COLUMN_U32}, {"n", COLUMN_U32}, {"d", COLUMN_U32}, {"c", COLUMN_U8}}};
+    size_t skipped = 0;
+
+    Tables() = default;
+    Tables(const Tables &) = delete; // all points into the instance
+
+    Table *all[6] = {&power, &beats, &pictures, &shares, &connections, &encounters};
+
+    // Opens the files of all tables, adding suffix to their names
+    bool open(const std::string &dir, bool csv, const std::string &suffix)
+    {
+        for (Table *table : all)
+        {
+            for (size_t c = 0; c < (csv ? 1 : table->columns.size()); c++)
+            {
+                std::string path = tablePath(dir, *table, c, csv) + suffix;
+                FILE *file = fopen(path.c_str(), "wb");
+                if (file == nullptr)
+                {
+                    perror(path.c_str());
+                    return false;
+                }
+                table->files.push_back(file);
+            }
+        }
+        return true;
+    }
+
+    bool close()
+    {
+        bool ok = true;
+        for (Table *table : all)
+        {
+            for (FILE *file : table->files)
+            {
+                ok &= !ferror(file) && fclose(file) == 0;
+            }
+            table->files.clear();
+        }
+        return ok;
+    }
+
+    ~Tables() { close(); }
+
+    // <table>.csv, or <table>.<column>.<type> for packed little endian values
+    static std::string tablePath(const std::string &dir, const Table &table, size_t column, bool csv)
+    {
+        static const char *suffix[] = {"u8", "i32", "u32", "u64"};
+        if (csv)
+        {
+            return dir + "/" + table.name + ".csv";
+        }
+        const Column &c = table.columns[column];
+        return dir + "/" + table.name + "." + c.name + "." + suffix[c.type];
+    }
+};
+
+// Turns the events of one badge into table rows
+class EventSink
+{
+public:
+    EventSink(Tables &tables, uint32_t badge) : _tables(tables), _badge(badge) {}
+
+    void setBadge(uint32_t badge) { _badge = badge; }
+
+    void event(uint8_t type, int64_t t, uint32_t s, uint32_t node, int32_t value, uint8_t pic)
+    {
+        switch (type)
+        {
+        case BadgeEvent::POWER_EVT:
+            _tables.power.add({_badge, t, s});
+            break;
+        case BadgeEvent::BEAT_EVT:
+            _tables.beats.add({_badge, t, s, node, value});
+            break;
+        case BadgeEvent::PICTURE_EVT:
+            _tables.pictures.add({_badge, t, s, pic});
+            break;
+        case BadgeEvent::SHARE_EVT:
+            _tables.shares.add({_badge, t, s, node, pic});
+            break;
+        case BadgeEvent::NODE_JOIN_EVT:
+            _tables.connections.add({_badge, t, s, CONNECTION_JOIN, node});
+            break;
+        case BadgeEvent::NODE_LEAVE_EVT:
+            _tables.connections.add({_badge, t, s, CONNECTION_LEAVE, node});
+            break;
+        case BadgeEvent::ENCOUNTER_EVT:
+            // Same layout as the other events: first seen, peer, duration and count
+            _tables.encounters.add({_badge, t, s, node, value, pic});
+            break;
+        default:
+            _tables.skipped++;
+            break;
+        }
+    }
+
+    void keyframe(int64_t t, uint32_t s, const uint32_t *nodes, size_t count)
+    {
+        if (count == 0)
+        {
+            _tables.connections.add({_badge, t, s, CONNECTION_KEYFRAME, 0});
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            _tables.connections.add({_badge, t, s, CONNECTION_KEYFRAME, nodes[i]});
+        }
+    }
+
+private:
+    Tables &_tables;
+    uint32_t _badge;
+};
+
+// Decodes fixed-size binary records, reassembling connection keyframes from
+// their continuation records
+class BinaryDecoder
+{
+public:
+    BinaryDecoder(EventSink &sink, Tables &tables) : _sink(sink), _tables(tables) {}
+
+    void feed(const uint8_t *data, size_t len)
+    {
+        while (len > 0)
+        {
+            size_t n = std::min(len, sizeof(logRecord_t) - _filled);
+            memcpy((uint8_t *)&_record + _filled, data, n);
+            _filled += n;
+            data += n;
+            len -= n;
+            if (_filled == sizeof(logRecord_t))
+            {
+                record(_record);
+                _filled = 0;
+            }
+        }
+    }
+
+    void finish()
+    {
+        completeKeyframe();
+    }
+
+private:
+    EventSink &_sink;
+    Tables &_tables;
+    logRecord_t _record;
+    size_t _filled = 0;
+
+    logRecord_t _keyframe;
+    uint32_t _keyframeNodes[LOG_MAX_NODES];
+    size_t _pendingNodes = 0;
+    size_t _collectedNodes = 0;
+    bool _inKeyframe = false;
+
+    void record(const logRecord_t &record)
+    {
+        if (!logRecordValid(record))
+        {
+            _tables.skipped++;
+            return;
+        }
+        if (record.type == LOG_RECORD_CONTINUATION)
+        {
+            for (size_t i = 0; i < LOG_NODES_PER_RECORD && _pendingNodes > 0; i++, _pendingNodes--)
+            {
+                _keyframeNodes[_collectedNodes++] = record.nodes[i];
+            }
+            if (_pendingNodes == 0)
+            {
+                completeKeyframe();
+            }
+            return;
+        }
+
+        // A truncated keyframe is kept with the nodes found so far
+        completeKeyframe();
+
+        if (record.type == LOG_RECORD_HEADER)
+        {
+            if (record.header.magic != LOG_MAGIC || record.header.version != LOG_FORMAT_VERSION)
+            {
+                fprintf(stderr, "Unsupported log format version %u\n", record.header.version);
+            }
+        }
+        else if (record.type == BadgeEvent::CONNECTION_EVT)
+        {
+            _keyframe = record;
+            _inKeyframe = true;
+            _pendingNodes = record.arg;
+            _collectedNodes = 0;
+            if (_pendingNodes == 0)
+            {
+                completeKeyframe();
+            }
+        }
+        else
+        {
+            _sink.event(record.type, record.event.time, record.event.date, record.event.node, record.event.value, record.arg);
+        }
+    }
+
+    void completeKeyframe()
+    {
+        if (_inKeyframe)
+        {
+            _sink.keyframe(_keyframe.event.time, _keyframe.event.date, _keyframeNodes, _collectedNodes);
+            _inKeyframe = false;
+            _pendingNodes = 0;
+        }
+    }
+};
+
+// Decodes the JSON lines printed by printLog() and the former JSON log. Only
+// flat objects with numbers and arrays of numbers occur, so a small scanner
+// suffices.
+class TextDecoder
+{
+public:
+    TextDecoder(EventSink &sink, Tables &tables) : _sink(sink), _tables(tables) {}
+
+    void feed(const uint8_t *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            if (data[i] == '\n')
+            {
+                line(_line);
+                _line.clear();
+            }
+            else if (data[i] != '\r')
+            {
+                _line += (char)data[i];
+            }
+        }
+    }
+
+    void finish()
+    {
+        line(_line);
+        _line.clear();
+    }
+
+private:
+    EventSink &_sink;
+    Tables &_tables;
+    std::string _line;
+
+    void line(const std::string &text)
+    {
+        unsigned long badge;
+        if (sscanf(text.c_str(), "LOGSTART%lu", &badge) == 1)
+        {
+            _sink.setBadge(badge);
+            return;
+        }
+        const char *p = strchr(text.c_str(), '{');
+        if (p == nullptr)
+        {
+            return; // debug output of the badge
+        }
+
+        bool hasT = false, hasE = false;
+        uint64_t t = 0;
+        uint32_t s = 0, node = 0;
+        int32_t beat = 0;
+        int pic = 0;
+        unsigned long type = 0;
+        std::vector<uint32_t> nodes;
+        bool nodeList = false;
+
+        while ((p = strchr(p, '"')) != nullptr)
+        {
+            const char key = p[1];
+            p = strchr(p + 1, '"');
+            if (p == nullptr || p[1] != ':')
+            {
+                break;
+            }
+            p += 2;
+            if (*p == '[')
+            {
+                nodeList = true;
+                p++;
+                while (*p != ']' && *p != '\0')
+                {
+                    char *end;
+                    unsigned long value = strtoul(p, &end, 10);
+                    if (end == p)
+                    {
+                        p++;
+                        continue;
+                    }
+                    nodes.push_back(value);
+                    p = end;
+                }
+                continue;
+            }
+            char *end;
+            long long value = strtoll(p, &end, 10);
+            if (end == p)
+            {
+                break;
+            }
+            p = end;
+            switch (key)
+            {
+            case 't': t = value; hasT = true; break;
+            case 's': s = value; break;
+            case 'e': type = value; hasE = true; break;
+            case 'n': node = value; break;
+            case 'p': pic = value; break;
+            case 'b': beat = value; break;
+            // Encounters share the fields of their binary layout
+            case 'f': s = value; break;
+            case 'd': beat = value; break;
+            case 'c': pic = value; break;
+            }
+        }
+
+        if (!hasT || !hasE)
+        {
+            _tables.skipped++;
+        }
+        else if (type == BadgeEvent::CONNECTION_EVT && nodeList)
+        {
+            _sink.keyframe(t, s, nodes.data(), nodes.size());
+        }
+        else
+        {
+            _sink.event(type, t, s, node, beat, pic);
+        }
+    }
+};
+
+// Falls back to the leading digits of the file name, e.g. 2884960141.bin
+static uint32_t badgeFromPath(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    const char *name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+    return strtoul(name, nullptr, 10);
+}
+
+static bool decodeFile(const std::string &path, Tables &tables)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        perror(path.c_str());
+        return false;
+    }
+
+    static const size_t BLOCK = 1 << 16;
+    std::vector<uint8_t> block(BLOCK);
+    size_t len = fread(block.data(), 1, BLOCK, file);
+
+    EventSink sink(tables, badgeFromPath(path));
+    BinaryDecoder binary(sink, tables);
+    TextDecoder text(sink, tables);
+
+    // Binary logs always start with a header record. Its magic and version
+    // are at the same place in all format versions.
+    logRecord_t first;
+    bool isBinary = false;
+    if (len >= sizeof(first))
+    {
+        memcpy(&first, block.data(), sizeof(first));
+        isBinary = first.type == LOG_RECORD_HEADER && first.header.magic == LOG_MAGIC;
+        if (isBinary && first.header.version != LOG_FORMAT_VERSION)
+        {
+            fprintf(stderr, "%s: unsupported log format version %u\n", path.c_str(), first.header.version);
+            fclose(file);
+            return false;
+        }
+    }
+
+    while (len > 0)
+    {
+        if (isBinary)
+            binary.feed(block.data(), len);
+        else
+            text.feed(block.data(), len);
+        len = fread(block.data(), 1, BLOCK, file);
+    }
+    binary.finish();
+    text.finish();
+
+    fclose(file);
+    return true;
+}
+
+static std::string partSuffix(size_t part)
+{
+    return "." + std::to_string(part) + ".part";
+}
+
+// Joins the part files of all inputs into path, behind an optional header line
+static bool joinParts(const std::string &path, const std::string &header, size_t parts)
+{
+    FILE *out = fopen(path.c_str(), "wb");
+    if (out == nullptr)
+    {
+        perror(path.c_str());
+        return false;
+    }
+    fputs(header.c_str(), out);
+
+    std::vector<uint8_t> block(1 << 16);
+    for (size_t i = 0; i < parts; i++)
+    {
+        std::string partPath = path + partSuffix(i);
+        FILE *part = fopen(partPath.c_str(), "rb");
+        if (part == nullptr)
+        {
+            continue; // the input could not be read
+        }
+        size_t len;
+        while ((len = fread(block.data(), 1, block.size(), part)) > 0)
+        {
+            fwrite(block.data(), 1, len, out);
+        }
+        fclose(part);
+        remove(partPath.c_str());
+    }
+
+    bool ok = !ferror(out);
+    ok &= fclose(out) == 0;
+    if (!ok)
+    {
+        perror(path.c_str());
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    std::string format = "csv";
+    std::string outdir = ".";
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            format = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            outdir = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = std::max(1, atoi(argv[++i]));
+        else
+            inputs.push_back(argv[i]);
+    }
+    if (inputs.empty() || (format != "csv" && format != "bin"))
+    {
+        fprintf(stderr, "Usage: %s [-f csv|bin] [-o outdir] [-j threads] <log file>...\n", argv[0]);
+        return 2;
+    }
+
+    // Every file is decoded on its own into part files, joined in input order
+    // afterwards
+    const bool csv = format == "csv";
+    std::vector<size_t> rows(inputs.size() * 6);
+    std::vector<size_t> skipped(inputs.size());
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < std::min<size_t>(threads, inputs.size()); w++)
+    {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < inputs.size(); i = next++)
+            {
+                Tables tables;
+                if (!tables.open(outdir, csv, partSuffix(i)) || !decodeFile(inputs[i], tables) || !tables.close())
+                    failed = true;
+                for (size_t t = 0; t < 6; t++)
+                    rows[i * 6 + t] = tables.all[t]->rows;
+                skipped[i] = tables.skipped;
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    Tables schema;
+    size_t skippedTotal = 0;
+    for (size_t t = 0; t < 6; t++)
+    {
+        const Table &table = *schema.all[t];
+        std::string header;
+        for (size_t c = 0; csv && c < table.columns.size(); c++)
+        {
+            header += (c == 0 ? "" : ",") + std::string(table.columns[c].name);
+        }
+        for (size_t c = 0; c < (csv ? 1 : table.columns.size()); c++)
+        {
+            if (!joinParts(Tables::tablePath(outdir, table, c, csv), csv ? header + "\n" : "", inputs.size()))
+                return 1;
+        }
+
+        size_t tableRows = 0;
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            tableRows += rows[i * 6 + t];
+        }
+        fprintf(stderr, "%-12s %zu rows\n", table.name, tableRows);
+    }
+    for (size_t count : skipped)
+    {
+        skippedTotal += count;
+    }
+    if (skippedTotal > 0)
+    {
+        fprintf(stderr, "Skipped %zu corrupted or unknown entries\n", skippedTotal);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+// logreceiver - Collects the interaction log of a badge over the serial port
+//
+// Requests a framed bulk export (see LogFormat.h) and writes the exported
+// stream to a file. Broken frames or timeouts make it request the rest of the
+// log again from the last good offset, and --resume continues a file left
+// behind by an earlier, interrupted run. Offsets count from the first segment
+// on the badge, so the transfer starts over when that segment changed.
+//
+// With --collect, it instead listens to a collector node (env:collector),
+// which forwards the segments the badges upload over the mesh, and writes
+// every segment to <output dir>/<node>_<segment>.bin until interrupted.
+//
+// Usage: logreceiver [-b baud] [--resume] <port> <output file>
+//        logreceiver [-b baud] --collect <port> <output dir>
+
+#include "LogFormat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static const int CONSOLE_BAUD = 115200;
+static const int FRAME_TIMEOUT_MS = 2000;
+static const int MAX_ATTEMPTS = 10;
+static const int COLLECT_BAUD = 921600;         // UPLOAD_COLLECTOR_BAUD in include/defaults.h
+static const uint32_t MAX_SEGMENT_FRAME = 4096; // larger payloads are taken for broken headers
+
+static speed_t speedFor(int baud)
+{
+    switch (baud)
+    {
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    default: return 0;
+    }
+}
+
+static bool setBaud(int fd, int baud)
+{
+    speed_t speed = speedFor(baud);
+    termios tty;
+    if (speed == 0 || tcgetattr(fd, &tty) != 0)
+    {
+        fprintf(stderr, "Unsupported baud rate %d\n", baud);
+        return false;
+    }
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    return tcsetattr(fd, TCSANOW, &tty) == 0;
+}
+
+// Reads exactly len bytes unless the line stays silent for timeoutMs
+static bool readFully(int fd, uint8_t *buffer, size_t len, int timeoutMs)
+{
+    while (len > 0)
+    {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0)
+        {
+            return false;
+        }
+        ssize_t n = read(fd, buffer, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Waits for the line "EXPORT <baud>", skipping debug output of the badge
+static int waitForExport(int fd)
+{
+    std::string line;
+    uint8_t c;
+    while (readFully(fd, &c, 1, 5000))
+    {
+        if (c != '\n')
+        {
+            line += (char)c;
+            continue;
+        }
+        int baud;
+        if (sscanf(line.c_str(), "EXPORT %d", &baud) == 1)
+        {
+            return baud;
+        }
+        line.clear();
+    }
+    return 0;
+}
+
+// Drops everything until the badge stopped sending, e.g. after a broken frame
+static void drain(int fd)
+{
+    uint8_t buffer[256];
+    while (readFully(fd, buffer, 1, 500))
+    {
+        (void)!read(fd, buffer, sizeof(buffer));
+    }
+}
+
+enum transferResult_t
+{
+    TRANSFER_COMPLETE,
+    TRANSFER_BROKEN,
+    TRANSFER_FAILED
+};
+
+// first is the segment the stream in out starts with, valid if offset > 0
+static transferResult_t transfer(int fd, int out, uint32_t &offset, uint32_t &first, int exportBaud)
+{
+    char request[32];
+    int len = snprintf(request, sizeof(request), "EXPORT %u\n", offset);
+    if (!setBaud(fd, CONSOLE_BAUD) || write(fd, request, len) != len)
+    {
+        return TRANSFER_FAILED;
+    }
+
+    int baud = waitForExport(fd);
+    if (baud == 0)
+    {
+        fprintf(stderr, "Badge did not answer the export request\n");
+        return TRANSFER_BROKEN;
+    }
+    if ((exportBaud != 0 && baud != exportBaud) || !setBaud(fd, baud))
+    {
+        return TRANSFER_FAILED;
+    }
+
+    std::vector<uint8_t> payload;
+    uint32_t expectedSeq = 0;
+    uint32_t total = 0;
+    for (;;)
+    {
+        // Find the sync word, then read the rest of the header
+        logFrameHeader_t header;
+        uint8_t *raw = (uint8_t *)&header;
+        if (!readFully(fd, raw, 1, FRAME_TIMEOUT_MS))
+        {
+            return TRANSFER_BROKEN;
+        }
+        if (raw[0] != (LOG_FRAME_SYNC & 0xff))
+        {
+            continue;
+        }
+        if (!readFully(fd, raw + 1, sizeof(header) - 1, FRAME_TIMEOUT_MS) || header.sync != LOG_FRAME_SYNC)
+        {
+            return TRANSFER_BROKEN;
+        }
+
+        uint32_t crc;
+        payload.resize(header.length);
+        if (!readFully(fd, payload.data(), payload.size(), FRAME_TIMEOUT_MS) ||
+            !readFully(fd, (uint8_t *)&crc, sizeof(crc), FRAME_TIMEOUT_MS))
+        {
+            return TRANSFER_BROKEN;
+        }
+        uint32_t expectedCrc = logCrc32(raw, sizeof(header));
+        expectedCrc = logCrc32(payload.data(), payload.size(), expectedCrc);
+        if (crc != expectedCrc || header.seq != expectedSeq++)
+        {
+            fprintf(stderr, "Broken frame %u at offset %u\n", header.seq, header.offset);
+            return TRANSFER_BROKEN;
+        }
+
+        switch (header.type)
+        {
+        case LOG_FRAME_START:
+        {
+            uint32_t start[2];
+            if (payload.size() != sizeof(start))
+            {
+                fprintf(stderr, "Unexpected start frame, the firmware of the badge does not match\n");
+                return TRANSFER_FAILED;
+            }
+            memcpy(start, payload.data(), sizeof(start));
+            total = start[0];
+            if (offset > 0 && start[1] != first)
+            {
+                // The data at offset is not the continuation of the file anymore
+                fprintf(stderr, "Log starts at segment %u instead of %u now, starting over\n", start[1], first);
+                offset = 0;
+                ftruncate(out, 0);
+                return TRANSFER_BROKEN;
+            }
+            first = start[1];
+            fprintf(stderr, "Receiving %u bytes from node %u, starting at %u\n", total, header.node, offset);
+            break;
+        }
+        case LOG_FRAME_DATA:
+            if (header.offset != offset)
+            {
+                return TRANSFER_BROKEN;
+            }
+            if (pwrite(out, payload.data(), payload.size(), offset) != (ssize_t)payload.size())
+            {
+                perror("write");
+                return TRANSFER_FAILED;
+            }
+            offset += payload.size();
+            fprintf(stderr, "\r%u / %u bytes", offset, total);
+            break;
+        case LOG_FRAME_END:
+            fprintf(stderr, "\n");
+            if (header.offset != offset)
+            {
+                return TRANSFER_BROKEN;
+            }
+            ftruncate(out, offset);
+            return TRANSFER_COMPLETE;
+        default:
+            return TRANSFER_BROKEN;
+        }
+    }
+}
+
+// Writes the segment frames of a collector to their files. Broken frames are
+// skipped, the collector only forwards chunks the badges send again.
+static int collect(int fd, const char *dir, int baud)
+{
+    if (!setBaud(fd, baud))
+    {
+        return 1;
+    }
+    fprintf(stderr, "Collecting segments into %s\n", dir);
+
+    std::vector<uint8_t> payload;
+    for (;;)
+    {
+        logFrameHeader_t header;
+        uint8_t *raw = (uint8_t *)&header;
+        if (!readFully(fd, raw, 1, -1))
+        {
+            return 1;
+        }
+        if (raw[0] != (LOG_FRAME_SYNC & 0xff))
+        {
+            continue;
+        }
+        if (!readFully(fd, raw + 1, sizeof(header) - 1, FRAME_TIMEOUT_MS) || header.sync != LOG_FRAME_SYNC ||
+            header.type != LOG_FRAME_SEGMENT || header.length <= sizeof(uint32_t) || header.length > MAX_SEGMENT_FRAME)
+        {
+            continue;
+        }
+
+        uint32_t crc;
+        payload.resize(header.length);
+        if (!readFully(fd, payload.data(), payload.size(), FRAME_TIMEOUT_MS) ||
+            !readFully(fd, (uint8_t *)&crc, sizeof(crc), FRAME_TIMEOUT_MS))
+        {
+            continue;
+        }
+        uint32_t expectedCrc = logCrc32(raw, sizeof(header));
+        expectedCrc = logCrc32(payload.data(), payload.size(), expectedCrc);
+        if (crc != expectedCrc)
+        {
+            fprintf(stderr, "Broken frame %u from node %u\n", header.seq, header.node);
+            continue;
+        }
+
+        uint32_t segment;
+        memcpy(&segment, payload.data(), sizeof(segment));
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%u_%05u.bin", dir, header.node, segment);
+        int out = open(path, O_WRONLY | O_CREAT, 0644);
+        size_t length = payload.size() - sizeof(segment);
+        if (out < 0 || pwrite(out, payload.data() + sizeof(segment), length, header.offset) != (ssize_t)length)
+        {
+            perror(path);
+            return 1;
+        }
+        close(out);
+        fprintf(stderr, "%s: %u bytes at %u\n", path, (unsigned)length, header.offset);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int exportBaud = 0;
+    bool resume = false;
+    bool collecting = false;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            exportBaud = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if (strcmp(argv[i], "--collect") == 0)
+            collecting = true;
+        else
+            args.push_back(argv[i]);
+    }
+    if (args.size() != 2)
+    {
+        fprintf(stderr, "Usage: %s [-b baud] [--resume] <port> <output file>\n"
+                        "       %s [-b baud] --collect <port> <output dir>\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+
+    int fd = open(args[0], O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+        perror(args[0]);
+        return 1;
+    }
+    if (collecting)
+    {
+        int result = collect(fd, args[1], exportBaud != 0 ? exportBaud : COLLECT_BAUD);
+        close(fd);
+        return result;
+    }
+    int out = open(args[1], O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+    if (out < 0)
+    {
+        perror(args[1]);
+        return 1;
+    }
+
+    uint32_t offset = 0;
+    uint32_t first = 0;
+    struct stat st;
+    logRecord_t record;
+    if (resume && fstat(out, &st) == 0 &&
+        pread(out, &record, sizeof(record), 0) == (ssize_t)sizeof(record) &&
+        record.type == LOG_RECORD_HEADER && logRecordValid(record))
+    {
+        // The stream starts with the header of its first segment. A partial
+        // record is requested again as a whole.
+        first = record.header.segment;
+        offset = st.st_size - st.st_size % sizeof(logRecord_t);
+    }
+
+    transferResult_t result = TRANSFER_BROKEN;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS && result == TRANSFER_BROKEN; attempt++)
+    {
+        result = transfer(fd, out, offset, first, exportBaud);
+        if (result == TRANSFER_BROKEN)
+        {
+            drain(fd);
+            fprintf(stderr, "Resuming at offset %u\n", offset);
+        }
+    }
+
+    setBaud(fd, CONSOLE_BAUD);
+    close(out);
+    close(fd);
+    return result == TRANSFER_COMPLETE ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+// rosterbench - Measures the import of BADGES_FILE as the roster grows
+//
+// Generates rosters of increasing size and resolves the last badge in each of
+// them, once by parsing the whole file into a single document like earlier
+// firmware did, and once with the streaming import of RosterImport.h. The pool
+// columns are bytes of ArduinoJson memory pools: the part of the single
+// document the parsed roster occupies, and the constant capacity of the two
+// documents the streaming import uses. Other allocations are not included, and
+// the sizes depend on the pointer size of the host, so they are only comparable
+// between the two columns, not to the badge.
+//
+// Usage: rosterbench [roster sizes...]
+
+#include "defaults.h"
+#include "RosterImport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int REPETITIONS = 20;
+
+static std::string makeRoster(size_t numBadges)
+{
+    std::string json = "[\n";
+    char line[128];
+    for (size_t i = 0; i < numBadges; i++)
+    {
+        snprintf(line, sizeof(line),
+                 "  {\"id\": %zu, \"group\": %zu, \"color\": \"%06zx\", \"name\": \"Badge %zu\", \"pics\": [%zu, %zu, %zu]}%s\n",
+                 1000 + i, i / MAX_GROUP_SIZE, (i * 0x10101) & 0xffffff, i, i % 7, i % 11, i % 13,
+                 i + 1 < numBadges ? "," : "");
+        json += line;
+    }
+    return json + "]\n";
+}
+
+template <typename F>
+static double averageMicros(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REPETITIONS; i++)
+    {
+        f();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / REPETITIONS;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes = {3, 20, 100, 1000, 5000};
+    if (argc > 1)
+    {
+        sizes.clear();
+        for (int i = 1; i < argc; i++)
+        {
+            sizes.push_back(strtoul(argv[i], nullptr, 10));
+        }
+    }
+
+    printf("%8s %10s | %13s %10s | %13s %10s\n", "badges", "file", "document pool", "time", "stream pool", "time");
+    for (size_t numBadges : sizes)
+    {
+        std::string json = makeRoster(numBadges);
+        uint32_t nodeid = 1000 + numBadges - 1;
+
+        // Whole file in one document
+        size_t documentPool = 0;
+        bool documentFound = false;
+        double documentTime = averageMicros([&]() {
+            DynamicJsonDocument doc(json.size() * 2);
+            deserializeJson(doc, json);
+            documentPool = doc.memoryUsage();
+            documentFound = false;
+            for (JsonObject elem : doc.as<JsonArray>())
+            {
+                if (elem[CONFIG_KEY_ID] == nodeid)
+                {
+                    documentFound = true;
+                    break;
+                }
+            }
+        });
+
+        // Streaming import, two passes over the roster
+        bool streamFound = false;
+        double streamTime = averageMicros([&]() {
+            std::istringstream input(json);
+            badges_t badge;
+            uint32_t group[MAX_GROUP_SIZE];
+            importRosterEntry(
+                input, [&input]() { input.clear(); input.seekg(0); }, nodeid, badge, group, MAX_GROUP_SIZE, streamFound);
+        });
+        size_t streamPool = ROSTER_ENTRY_MEMORY + ROSTER_FILTER_MEMORY;
+
+        if (!documentFound || !streamFound)
+        {
+            fprintf(stderr, "Badge %u not found in a roster of %zu badges\n", nodeid, numBadges);
+            return 1;
+        }
+        printf("%8zu %10zu | %13zu %8.0fus | %13zu %8.0fus\n", numBadges, json.size(),
+               documentPool, documentTime, streamPool, streamTime);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// meshclock_test - Checks MeshClock against a simulated local clock and mesh
+// node time, including sync steps larger than 2^31 us and wraps of the 32 bit
+// node time.
+
+#include "MeshClock.h"
+
+#include <stdio.h>
+
+static uint64_t localTime = 0;  // us since boot of the simulated node
+static uint32_t meshAdjuster = 0; // what the time sync of the mesh added
+
+static uint64_t localSource() { return localTime; }
+static uint32_t meshSource() { return (uint32_t)localTime + meshAdjuster; }
+
+static int failures = 0;
+
+#define CHECK_EQUAL(actual, expected)                                                   \
+    do                                                                                  \
+    {                                                                                   \
+        unsigned long long a = (actual), e = (expected);                                \
+        if (a != e)                                                                     \
+        {                                                                               \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual, a, e); \
+            failures++;                                                                 \
+        }                                                                               \
+    } while (0)
+
+// Steps the mesh node time to meshTime, as a time sync does
+static void sync(MeshClock &clock, uint32_t meshTime)
+{
+    meshAdjuster = meshTime - (uint32_t)localTime;
+    clock.adjust();
+}
+
+static void testJoinRunningMesh()
+{
+    localTime = 2000000;
+    meshAdjuster = 0;
+    MeshClock clock(localSource, meshSource);
+    CHECK_EQUAL(clock.now(), 2000000);
+
+    // Larger than 2^31 us forward, as a signed step it would go before boot
+    sync(clock, 3500000000u);
+    CHECK_EQUAL(clock.now(), 3500000000u);
+    localTime += 1000;
+    CHECK_EQUAL(clock.now(), 3500001000u);
+    CHECK_EQUAL((uint32_t)clock.now(), meshSource());
+}
+
+static void testStepsOfRunningClock()
+{
+    localTime = 10000000000ull;
+    meshAdjuster = 0;
+    MeshClock clock(localSource, meshSource);
+    const uint64_t start = clock.now();
+
+    sync(clock, meshSource() - 100);
+    CHECK_EQUAL(clock.now(), start - 100);
+    sync(clock, meshSource() + 5000);
+    CHECK_EQUAL(clock.now(), start + 4900);
+
+    // A step of more than 2^31 us is ambiguous in 32 bits, it is taken as the
+    // signed step, which keeps the low 32 bits and stays after boot
+    sync(clock, meshSource() + 3000000000u);
+    CHECK_EQUAL(clock.now(), start + 4900 + 3000000000ull - (1ull << 32));
+    CHECK_EQUAL((uint32_t)clock.now(), meshSource());
+}
+
+static void testWraps()
+{
+    localTime = 0;
+    meshAdjuster = 4000000000u;
+    MeshClock clock(localSource, meshSource);
+    CHECK_EQUAL(clock.now(), 4000000000u);
+
+    // No sampling needed between wraps of the node time
+    localTime += 3 * (1ull << 32) + 7;
+    CHECK_EQUAL(clock.now(), 4000000000ull + 3 * (1ull << 32) + 7);
+    CHECK_EQUAL((uint32_t)clock.now(), meshSource());
+
+    // Start time of another node from just before the last wrap
+    const uint64_t now = clock.now();
+    CHECK_EQUAL(clock.extend((uint32_t)now - 1000), now - 1000);
+    CHECK_EQUAL(clock.extend((uint32_t)now + 1000), now + 1000);
+}
+
+int main()
+{
+    testJoinRunningMesh();
+    testStepsOfRunningClock();
+    testWraps();
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("MeshClock: all checks passed\n");
+    return 0;
+}